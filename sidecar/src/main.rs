@@ -7,6 +7,7 @@ extern crate object;
 extern crate typed_arena;
 
 use std::borrow::Cow;
+use std::collections::HashSet;
 use std::fs::File;
 use std::io::{BufRead, Lines, StdinLock, Write};
 use std::path::Path;
@@ -21,7 +22,7 @@ use addr2line::{Context, Location};
 
 enum QueryType {
     Addr(u64),
-    CompileUnit(String),
+    CompileUnits(Vec<String>),
     _NotImplemented,
 }
 
@@ -29,7 +30,7 @@ fn parse_query_line(string: &str) -> QueryType {
     if string.starts_with("symbolize ") {
         QueryType::Addr(u64::from_str_radix(&string[10..], 16).expect("Failed to parse address"))
     } else if string.starts_with("query_syms ") {
-        QueryType::CompileUnit(string[11..].to_string())
+        QueryType::CompileUnits(string[11..].split_whitespace().map(String::from).collect())
     } else {
         panic!("Failed to parse request")
     }
@@ -228,25 +229,23 @@ fn query_address<T: gimli::Endianity>(
     std::io::stdout().flush().unwrap();
 }
 
-// List functions defined in compile unit(s) with vi sense.  For every
-// compile unit, it starts with a ':e <filename>' line following by
-// symbol lines that looks like ' <sym> <address>'.  Show a ':q' line
-// after all compile units as the last line of the query result.
-//
-// For example,
-// :e bpf.c
-//  bpf_prog_bind_map 0x127b0
-//  bpf_enable_stats 0x126a0
-//  bpf_task_fd_query 0x125a0
-//  ...
-// :q
-//
-fn query_compile_unit<T: gimli::Endianity>(
-    compile_unit: &str,
+// Non-inlined functions defined in a single compile unit. Compile unit name
+// is stored relative to the root of Linux source tree (see
+// conv_linux_src_loc()), which is what compile unit globs are matched
+// against.
+struct CompileUnitFuncs {
+    name: String,
+    funcs: Vec<(String, u64)>,
+}
+
+// Walk all compile units once and remember which functions each of them
+// defines. DWARF DIE traversal is by far the most expensive part of
+// answering compile unit queries, so this index is built lazily on the first
+// query and reused for all subsequent ones.
+fn build_cu_index<T: gimli::Endianity>(
     ctx: &Context<gimli::EndianSlice<T>>,
-    _config: &Config,
-) {
-    let cu_pattern = glob::Pattern::new(compile_unit).unwrap();
+) -> Vec<CompileUnitFuncs> {
+    let mut index = Vec::new();
     let dwarf = ctx.dwarf();
     let mut units = dwarf.units();
     while let Some(header) = units.next().expect("fail to parse units") {
@@ -256,11 +255,8 @@ fn query_compile_unit<T: gimli::Endianity>(
         }
         let name = unit.name.unwrap();
         let name = name.to_string().expect("name of a compile unit");
-        if !cu_pattern.matches(conv_linux_src_loc(name)) {
-            continue;
-        }
 
-        println!(":e {}", name);
+        let mut funcs = Vec::new();
         let mut entries = unit.entries();
         while let Some((_, entry)) = entries.next_dfs().expect("fail to parse entries") {
             if entry.tag() != gimli::DW_TAG_subprogram {
@@ -304,11 +300,59 @@ fn query_compile_unit<T: gimli::Endianity>(
                 .unwrap()
                 .to_string()
                 .expect("should have a string");
-            println!(" {} 0x{:x}", namestr, low_pc);
+            funcs.push((namestr.to_string(), low_pc));
         }
+
+        index.push(CompileUnitFuncs {
+            name: conv_linux_src_loc(name).to_string(),
+            funcs,
+        });
     }
-    println!(":q");
-    std::io::stdout().flush().unwrap();
+    index
+}
+
+// List functions defined in any of compile units matching at least one of
+// provided globs. Reply is binary and has the following layout (all integers
+// are in native byte order, as both sides are running on the same host):
+//
+//   u32 function count;
+//   then, for each function:
+//     u64 address;
+//     u32 name length;
+//     u8  name[name length]; (not zero-terminated)
+//
+// Each function name is reported at most once, even if it is defined in
+// multiple matching compile units.
+fn query_compile_units(globs: &[String], index: &[CompileUnitFuncs], _config: &Config) {
+    let patterns: Vec<glob::Pattern> = globs
+        .iter()
+        .map(|g| glob::Pattern::new(g).unwrap())
+        .collect();
+    let mut seen = HashSet::new();
+    let mut buf = Vec::new();
+    let mut cnt: u32 = 0;
+
+    for cu in index {
+        if !patterns.iter().any(|p| p.matches(&cu.name)) {
+            continue;
+        }
+
+        for (name, addr) in &cu.funcs {
+            if !seen.insert(name.as_str()) {
+                continue;
+            }
+            buf.extend_from_slice(&addr.to_ne_bytes());
+            buf.extend_from_slice(&(name.len() as u32).to_ne_bytes());
+            buf.extend_from_slice(name.as_bytes());
+            cnt += 1;
+        }
+    }
+
+    let stdout = std::io::stdout();
+    let mut out = stdout.lock();
+    out.write_all(&cnt.to_ne_bytes()).unwrap();
+    out.write_all(&buf).unwrap();
+    out.flush().unwrap();
 }
 
 fn load_file_section<'input, 'arena, Endian: gimli::Endianity>(
@@ -446,11 +490,14 @@ fn main() {
         .map(Addrs::Args)
         .unwrap_or_else(|| Addrs::Stdin(stdin.lock().lines()));
 
+    let mut cu_index = None;
+
     for addr_or_cunit in queries {
         match addr_or_cunit {
             QueryType::Addr(probe) => query_address(probe, &ctx, &symbols, &config),
-            QueryType::CompileUnit(compile_unit) => {
-                query_compile_unit(&compile_unit, &ctx, &config)
+            QueryType::CompileUnits(globs) => {
+                let index = cu_index.get_or_insert_with(|| build_cu_index(&ctx));
+                query_compile_units(&globs, index, &config)
             }
             _ => panic!("not implemented yet"),
         }
@@ -272,9 +272,9 @@ err_out:
 	return NULL;
 }
 
-int addr2line__symbolize(const struct addr2line *a2l, long addr, struct a2l_resp *resp)
+static int a2l_send_symbolize(const struct addr2line *a2l, long addr)
 {
-	int err, cnt = 0;
+	int err;
 
 	err = fprintf(a2l->write_pipe, "symbolize %lx\n", addr - a2l->kaslr_offset);
 	if (err <= 0) {
@@ -283,48 +283,116 @@ int addr2line__symbolize(const struct addr2line *a2l, long addr, struct a2l_resp
 			addr, addr - a2l->kaslr_offset, err);
 		return err;
 	}
-	fflush(a2l->write_pipe);
+
+	return 0;
+}
+
+/* Read one symbolization response, consisting of one or more frames (more
+ * than one if address belongs to inlined code). Frames beyond max_cnt are
+ * consumed, but discarded.
+ */
+static int a2l_recv_symbolize(const struct addr2line *a2l, struct a2l_resp *resp, int max_cnt)
+{
+	struct a2l_resp tmp;
+	int err, cnt = 0;
 
 	while (true) {
-		if (fgets(resp->fname, sizeof(resp->fname), a2l->read_pipe) == NULL) {
+		struct a2l_resp *r = cnt < max_cnt ? resp : &tmp;
+
+		if (fgets(r->fname, sizeof(r->fname), a2l->read_pipe) == NULL) {
 			err = -errno;
 			fprintf(stderr, "Failed to get symbolized function name: %d\n", err);
 			return err;
 		}
-		resp->fname[strlen(resp->fname) - 1] = '\0';
+		r->fname[strlen(r->fname) - 1] = '\0';
 
 		/* empty line denotes end of response */
-		if (resp->fname[0] == '\0')
+		if (r->fname[0] == '\0')
 			break;
 
-		if (fgets(resp->line, sizeof(resp->line), a2l->read_pipe) == NULL) {
+		if (fgets(r->line, sizeof(r->line), a2l->read_pipe) == NULL) {
 			err = -errno;
 			fprintf(stderr, "Failed to get file/line info: %d\n", err);
 			return err;
 		}
 
-		resp->line[strlen(resp->line) - 1] = '\0';
+		r->line[strlen(r->line) - 1] = '\0';
 
-		if (strcmp(resp->line, "??:0:0") == 0)
+		if (strcmp(r->line, "??:0:0") == 0)
 			continue;
 
-		resp++;
-		cnt++;
+		if (cnt < max_cnt) {
+			resp++;
+			cnt++;
+		}
 	}
 
 	return cnt;
 }
 
-int addr2line__query_symbols(const struct addr2line *a2l, const char *compile_unit,
-			     struct a2l_cu_resp **resp_ret)
+int addr2line__symbolize(const struct addr2line *a2l, long addr, struct a2l_resp *resp)
 {
-	int cnt = 0;
-	int buf_size = 64;
-	int err = 0;
-	struct a2l_cu_resp *buf = NULL;
-	struct a2l_cu_resp *resp;
+	int err;
+
+	err = a2l_send_symbolize(a2l, addr);
+	if (err)
+		return err;
+	fflush(a2l->write_pipe);
+
+	return a2l_recv_symbolize(a2l, resp, A2L_MAX_FRAMES);
+}
+
+/* Number of symbolization requests sent to sidecar before reading back
+ * responses. It saves a round trip per address, while keeping both pipes
+ * from filling up and deadlocking us with the sidecar.
+ */
+#define A2L_BATCH_SZ 32
+
+int addr2line__symbolize_batch(const struct addr2line *a2l, const long *addrs, int addr_cnt,
+			       a2l_batch_fn fn, void *ctx)
+{
+	static struct a2l_resp resps[A2L_MAX_FRAMES];
+	int i, j, n, cnt, err;
+
+	for (i = 0; i < addr_cnt; i += n) {
+		n = addr_cnt - i < A2L_BATCH_SZ ? addr_cnt - i : A2L_BATCH_SZ;
+
+		for (j = 0; j < n; j++) {
+			err = a2l_send_symbolize(a2l, addrs[i + j]);
+			if (err)
+				return err;
+		}
+		fflush(a2l->write_pipe);
+
+		for (j = 0; j < n; j++) {
+			cnt = a2l_recv_symbolize(a2l, resps, A2L_MAX_FRAMES);
+			if (cnt < 0)
+				return cnt;
+
+			fn(i + j, resps, cnt, ctx);
+		}
+	}
+
+	return 0;
+}
 
-	err = fprintf(a2l->write_pipe, "query_syms %s\n", compile_unit);
+/* Query all functions defined in compile units matching any of provided
+ * globs. Sidecar replies in a compact binary format, see
+ * query_compile_units() in sidecar for details.
+ */
+int addr2line__query_symbols(const struct addr2line *a2l, const char **compile_units, int cu_cnt,
+			     struct a2l_cu_resp **resp_ret)
+{
+	struct a2l_cu_resp *buf = NULL, *resp;
+	uint32_t cnt, name_len;
+	uint64_t addr;
+	int err, i;
+
+	err = fprintf(a2l->write_pipe, "query_syms");
+	for (i = 0; i < cu_cnt && err > 0; i++)
+		err = fprintf(a2l->write_pipe, " %s", compile_units[i]);
+	if (err > 0)
+		err = fprintf(a2l->write_pipe, "\n");
 	if (err <= 0) {
 		err = -errno;
 		fprintf(stderr, "Failed to get function names from compile unit(s): %d\n", err);
@@ -332,82 +400,45 @@ int addr2line__query_symbols(const struct addr2line *a2l, const char *compile_un
 	}
 	fflush(a2l->write_pipe);
 
-	buf = (struct a2l_cu_resp *)malloc(sizeof(struct a2l_cu_resp) * buf_size);
-	if (buf == NULL) {
-		return -ENOMEM;
+	if (fread(&cnt, sizeof(cnt), 1, a2l->read_pipe) != 1) {
+		err = -errno;
+		fprintf(stderr, "Failed to get functions from compile unit(s): %d\n", err);
+		return err ?: -EIO;
 	}
 
-	err = 0;
-	while (true) {
-		char line[256];
-		if (fgets(line, sizeof(line), a2l->read_pipe) == NULL) {
-			err = -errno;
+	buf = calloc(cnt ?: 1, sizeof(*buf));
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < cnt; i++) {
+		resp = &buf[i];
+
+		if (fread(&addr, sizeof(addr), 1, a2l->read_pipe) != 1 ||
+		    fread(&name_len, sizeof(name_len), 1, a2l->read_pipe) != 1) {
+			err = -errno ?: -EIO;
 			fprintf(stderr, "Failed to get functions from compile unit(s): %d\n", err);
-			break;
-		}
-		if (line[0] == ':') {
-			if (line[1] == 'q') {
-				/* :q is the last end of the result */
-				break;
-			}
-			/* Skip :e lines since we don't need filename so far */
-			continue;
-		}
-		if (line[0] != ' ') {
-			fprintf(stderr, "Invalid format: %s\n", line);
-			err = -1;
-			break;
+			goto err_out;
 		}
-		/* |line| should be in the format of <spc><fuction><spc><address> */
-
-		if (cnt >= buf_size) {
-			buf_size *= 2;
-			buf = (struct a2l_cu_resp *)realloc(buf, sizeof(struct a2l_cu_resp) * buf_size);
-			if (buf == NULL) {
-				err = -ENOMEM;
-				break;
-			}
+		if (name_len >= sizeof(resp->fname)) {
+			fprintf(stderr, "Function name is too long (%u bytes)\n", name_len);
+			err = -E2BIG;
+			goto err_out;
 		}
-		resp = buf + cnt;
-
-		/* Get function name */
-		char *sep = strchr(line + 1, ' ');
-		if (sep == NULL) {
-			fprintf(stderr, "Invalid format: %s\n", line);
-			err = -1;
-			break;
-		}
-		*sep = 0;
-
-		if (sep - (line + 1) >= sizeof(resp->fname)) {
-			fprintf(stderr, "Function name is too long: %s\n", line + 1);
-			err = -1;
-			break;
+		if (name_len && fread(resp->fname, name_len, 1, a2l->read_pipe) != 1) {
+			err = -errno ?: -EIO;
+			fprintf(stderr, "Failed to get functions from compile unit(s): %d\n", err);
+			goto err_out;
 		}
-		strcpy(resp->fname, line + 1);
+		resp->fname[name_len] = '\0';
 
-		/* Get address */
-		char *addr_str = sep + 1;
-		if (addr_str[0] != '0' || addr_str[1] != 'x') {
-			fprintf(stderr, "Invalid address for function: %s %s\n", resp->fname, addr_str);
-			err = -1;
-			break;
-		}
-		addr_str += 2;
-		resp->address = (void *)(uintptr_t)strtoul(addr_str, NULL, 16);
 		/* compensate for KASLR */
-		resp->address += a2l->kaslr_offset;
-
-		cnt++;
-	}
-
-	if (err) {
-		if (buf != NULL)
-			free(buf);
-		return err;
+		resp->address = (void *)(uintptr_t)(addr + a2l->kaslr_offset);
 	}
 
 	*resp_ret = buf;
 	return cnt;
-}
 
+err_out:
+	free(buf);
+	return err;
+}
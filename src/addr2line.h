@@ -15,13 +15,22 @@ struct a2l_cu_resp
 	void* address;
 };
 
+/* maximum number of (inlined) frames returned for a single address */
+#define A2L_MAX_FRAMES 64
+
 struct addr2line;
 
+/* called for each address in a batch with its frames, outermost frame last */
+typedef void (*a2l_batch_fn)(int idx, const struct a2l_resp *resps, int resp_cnt, void *ctx);
+
 struct addr2line *addr2line__init(const char *vmlinux, long stext_addr, bool verbose, bool inlines);
 void addr2line__free(struct addr2line *a2l);
 
 long addr2line__kaslr_offset(const struct addr2line *a2l);
 int addr2line__symbolize(const struct addr2line *a2l, long addr, struct a2l_resp *resp);
-int addr2line__query_symbols(const struct addr2line *a2l, const char *compile_unit, struct a2l_cu_resp **resp_ret);
+int addr2line__symbolize_batch(const struct addr2line *a2l, const long *addrs, int addr_cnt,
+			       a2l_batch_fn fn, void *ctx);
+int addr2line__query_symbols(const struct addr2line *a2l, const char **compile_units, int cu_cnt,
+			     struct a2l_cu_resp **resp_ret);
 
 #endif /* __ADDR2LINE_H */
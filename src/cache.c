@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+/* retsnoop usually runs as root, but with HOME or XDG_CACHE_HOME pointing
+ * into some user's directory (e.g., sudo -E), so don't use cache directory
+ * that anyone else could have created or could modify
+ */
+static int check_dir(const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st))
+		return -errno;
+	if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH)))
+		return -EPERM;
+
+	return 0;
+}
+
+static int cache_path(char *buf, size_t buf_sz, const char *name, bool create)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n, err;
+
+	if (base && base[0])
+		n = snprintf(buf, buf_sz, "%s", base);
+	else if (home && home[0])
+		n = snprintf(buf, buf_sz, "%s/.cache", home);
+	else
+		return -ENOENT;
+	if (n < 0 || n >= buf_sz)
+		return -ENAMETOOLONG;
+
+	if (create && mkdir(buf, 0700) && errno != EEXIST)
+		return -errno;
+
+	n += snprintf(buf + n, buf_sz - n, "/retsnoop");
+	if (n >= buf_sz)
+		return -ENAMETOOLONG;
+
+	if (create && mkdir(buf, 0700) && errno != EEXIST)
+		return -errno;
+
+	err = check_dir(buf);
+	if (err)
+		return err;
+
+	n += snprintf(buf + n, buf_sz - n, "/%s", name);
+	if (n >= buf_sz)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+int cache__read(const char *name, void **data, size_t *sz)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	size_t off = 0;
+	ssize_t n;
+	void *buf = NULL;
+	int fd, err;
+
+	err = cache_path(path, sizeof(path), name, false);
+	if (err)
+		return err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		goto cleanup;
+	}
+
+	/* don't trust entries that someone else could have planted or
+	 * modified
+	 */
+	if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		err = -EPERM;
+		goto cleanup;
+	}
+
+	buf = malloc(st.st_size ?: 1);
+	if (!buf) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	while (off < st.st_size) {
+		n = read(fd, buf + off, st.st_size - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			err = n < 0 ? -errno : -EIO;
+			goto cleanup;
+		}
+		off += n;
+	}
+
+	*data = buf;
+	*sz = off;
+	buf = NULL;
+
+cleanup:
+	free(buf);
+	close(fd);
+	return err;
+}
+
+int cache__write(const char *name, const void *data, size_t sz)
+{
+	char path[PATH_MAX], tmp_path[PATH_MAX + 32];
+	size_t off = 0;
+	ssize_t n;
+	int fd, err;
+
+	err = cache_path(path, sizeof(path), name, true);
+	if (err)
+		return err;
+
+	/* write into a temporary file first, so that concurrent retsnoop
+	 * instances never see partially written entry; mkstemp() always
+	 * creates a new file, so it can't be tricked into following a
+	 * planted symlink
+	 */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.XXXXXX", path);
+	fd = mkstemp(tmp_path);
+	if (fd < 0)
+		return -errno;
+
+	while (off < sz) {
+		n = write(fd, data + off, sz - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			err = -errno;
+			break;
+		}
+		off += n;
+	}
+
+	if (close(fd) && !err)
+		err = -errno;
+	if (!err && rename(tmp_path, path))
+		err = -errno;
+	if (err)
+		unlink(tmp_path);
+
+	return err;
+}
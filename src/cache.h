@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stddef.h>
+
+/*
+ * On-disk cache of results of expensive startup steps, kept as one file per
+ * entry under $XDG_CACHE_HOME/retsnoop (~/.cache/retsnoop, by default).
+ * Caching is best-effort: users are expected to validate entry contents and
+ * to recompute results on any error.
+ */
+
+/* read whole cache entry into malloc()'ed buffer; entries not owned by
+ * effective user or writable by anyone else are rejected with -EPERM
+ */
+int cache__read(const char *name, void **data, size_t *sz);
+/* atomically create or replace cache entry */
+int cache__write(const char *name, const void *data, size_t sz);
+
+#endif /* __CACHE_H */
@@ -0,0 +1,372 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <linux/types.h>
+#include <linux/perf_event.h>
+#include <bpf/bpf.h>
+#include "retsnoop.h"
+#include "filters.h"
+
+#define CTL_BUF_SZ 4096
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+struct filters {
+	int tgids_fd;
+	int comms_fd;
+	int cgroups_fd;
+	struct filter_state *state;
+	bool verbose;
+
+	/* number of cgroup filters at each hierarchy level */
+	int cgroup_level_cnts[MAX_CGROUP_LEVEL];
+
+	int ctl_fd;
+	char *ctl_path;
+	bool ctl_created;
+	char buf[CTL_BUF_SZ];
+	int buf_len;
+};
+
+struct filters *filters__new(int tgids_fd, int comms_fd, int cgroups_fd,
+			     struct filter_state *state, bool verbose)
+{
+	struct filters *f;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+
+	f->tgids_fd = tgids_fd;
+	f->comms_fd = comms_fd;
+	f->cgroups_fd = cgroups_fd;
+	f->state = state;
+	f->verbose = verbose;
+	f->ctl_fd = -1;
+
+	return f;
+}
+
+void filters__free(struct filters *f)
+{
+	if (!f)
+		return;
+
+	if (f->ctl_fd >= 0)
+		close(f->ctl_fd);
+	if (f->ctl_created)
+		unlink(f->ctl_path);
+	free(f->ctl_path);
+	free(f);
+}
+
+/* Update verdict for a key in one of the filter maps, keeping allow/deny
+ * counters in sync. New entries are added to the map before counters are
+ * bumped and allowlist mode is turned on, so BPF side never sees non-empty
+ * allowlist without its entries.
+ */
+static int set_entry(struct filters *f, int map_fd, const void *key, enum filter_action action,
+		     __u32 *allow_cnt, __u32 *deny_cnt, bool *allowlist)
+{
+	bool old_verdict, verdict = action == FILTER_ALLOW;
+	bool exists;
+
+	exists = bpf_map_lookup_elem(map_fd, key, &old_verdict) == 0;
+
+	if (action == FILTER_REMOVE) {
+		if (!exists)
+			return 0;
+		if (bpf_map_delete_elem(map_fd, key))
+			return -errno;
+	} else {
+		if (exists && old_verdict == verdict)
+			return 0;
+		if (bpf_map_update_elem(map_fd, key, &verdict, BPF_ANY))
+			return -errno;
+		if (verdict) {
+			(*allow_cnt)++;
+			*allowlist = true;
+		} else
+			(*deny_cnt)++;
+	}
+
+	if (exists) {
+		if (old_verdict)
+			(*allow_cnt)--;
+		else
+			(*deny_cnt)--;
+	}
+
+	f->state->gen++;
+	return 0;
+}
+
+int filters__set_pid(struct filters *f, int tgid, enum filter_action action)
+{
+	return set_entry(f, f->tgids_fd, &tgid, action,
+			 &f->state->tgid_allow_cnt, &f->state->tgid_deny_cnt,
+			 &f->state->tgid_allowlist);
+}
+
+int filters__set_comm(struct filters *f, const char *comm, enum filter_action action)
+{
+	char buf[TASK_COMM_LEN] = {};
+
+	strncat(buf, comm, TASK_COMM_LEN - 1);
+
+	return set_entry(f, f->comms_fd, buf, action,
+			 &f->state->comm_allow_cnt, &f->state->comm_deny_cnt,
+			 &f->state->comm_allowlist);
+}
+
+static bool is_cgroup2(const char *path, struct stat *st)
+{
+	struct statfs sfs;
+
+	return statfs(path, &sfs) == 0 && sfs.f_type == CGROUP2_SUPER_MAGIC && stat(path, st) == 0;
+}
+
+/* Cgroup ID is the inode number of its cgroupfs directory (on kernels that
+ * support hierarchical cgroup filtering, at least), and its level is the
+ * number of ancestors up to the root of cgroup v2 hierarchy.
+ */
+static int cgroup_id_level(const char *path, __u64 *id, int *level)
+{
+	char buf[PATH_MAX], real[PATH_MAX], *p;
+	struct stat st, parent_st;
+
+	if (path[0] != '/') {
+		snprintf(buf, sizeof(buf), CGROUP_ROOT "/%s", path);
+		path = buf;
+	}
+	if (!realpath(path, real))
+		return -errno;
+
+	if (!is_cgroup2(real, &st))
+		return -ENOTDIR;
+	*id = st.st_ino;
+
+	*level = 0;
+	while ((p = strrchr(real, '/')) && p != real) {
+		*p = '\0';
+		if (!is_cgroup2(real, &parent_st) || parent_st.st_dev != st.st_dev)
+			break;
+		(*level)++;
+	}
+
+	return 0;
+}
+
+static void update_cgroup_levels(struct filters *f, int level, int delta)
+{
+	int i;
+
+	f->cgroup_level_cnts[level] += delta;
+	f->state->cgroup_levels = 0;
+	for (i = 0; i < MAX_CGROUP_LEVEL; i++) {
+		if (f->cgroup_level_cnts[i])
+			f->state->cgroup_levels |= 1U << i;
+	}
+}
+
+int filters__set_cgroup(struct filters *f, const char *path, enum filter_action action)
+{
+	bool verdict, added, removed;
+	int err, level;
+	__u64 cgid;
+
+	if (f->cgroups_fd < 0)
+		return -EOPNOTSUPP;
+
+	err = cgroup_id_level(path, &cgid, &level);
+	if (err)
+		return err;
+	if (level >= MAX_CGROUP_LEVEL)
+		return -E2BIG;
+
+	if (bpf_map_lookup_elem(f->cgroups_fd, &cgid, &verdict) == 0) {
+		added = false;
+		removed = action == FILTER_REMOVE;
+	} else {
+		added = action != FILTER_REMOVE;
+		removed = false;
+	}
+
+	/* BPF side only checks ancestors at levels marked in cgroup_levels,
+	 * so mark level before adding an entry and unmark it after removal
+	 */
+	if (added)
+		update_cgroup_levels(f, level, 1);
+
+	err = set_entry(f, f->cgroups_fd, &cgid, action,
+			&f->state->cgroup_allow_cnt, &f->state->cgroup_deny_cnt,
+			&f->state->cgroup_allowlist);
+	if (err) {
+		if (added)
+			update_cgroup_levels(f, level, -1);
+		return err;
+	}
+
+	if (removed)
+		update_cgroup_levels(f, level, -1);
+
+	return 0;
+}
+
+int filters__open_ctl(struct filters *f, const char *path)
+{
+	struct stat st;
+	int err;
+
+	f->ctl_path = strdup(path);
+	if (!f->ctl_path)
+		return -ENOMEM;
+
+	if (mkfifo(path, 0600) == 0) {
+		f->ctl_created = true;
+	} else if (errno != EEXIST || stat(path, &st) || !S_ISFIFO(st.st_mode)) {
+		err = -errno ?: -EINVAL;
+		fprintf(stderr, "Failed to create filter control pipe '%s': %d\n", path, err);
+		return err;
+	}
+
+	/* opening for writing as well keeps pipe from reporting EOF when
+	 * the last external writer goes away
+	 */
+	f->ctl_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (f->ctl_fd < 0) {
+		err = -errno;
+		fprintf(stderr, "Failed to open filter control pipe '%s': %d\n", path, err);
+		return err;
+	}
+
+	return 0;
+}
+
+static char *next_word(char **s)
+{
+	char *word;
+
+	*s += strspn(*s, " \t");
+	word = *s;
+	*s += strcspn(*s, " \t");
+	if (**s)
+		*(*s)++ = '\0';
+
+	return word;
+}
+
+static void process_cmd(struct filters *f, char *line)
+{
+	char *act_str, *kind, *val, *end;
+	enum filter_action action;
+	int err, pid;
+
+	act_str = next_word(&line);
+	kind = next_word(&line);
+	/* COMM can contain spaces, so take the rest of the line as is */
+	val = line + strspn(line, " \t");
+
+	if (act_str[0] == '\0' || act_str[0] == '#')
+		return;
+
+	if (strcmp(act_str, "allow") == 0) {
+		action = FILTER_ALLOW;
+	} else if (strcmp(act_str, "deny") == 0) {
+		action = FILTER_DENY;
+	} else if (strcmp(act_str, "remove") == 0) {
+		action = FILTER_REMOVE;
+	} else {
+		fprintf(stderr, "Unrecognized filter control action '%s'\n", act_str);
+		return;
+	}
+
+	if (strcmp(kind, "pid") == 0) {
+		errno = 0;
+		pid = strtol(val, &end, 10);
+		if (errno || *end || pid <= 0) {
+			fprintf(stderr, "Invalid PID '%s' in filter control command\n", val);
+			return;
+		}
+		err = filters__set_pid(f, pid, action);
+	} else if (strcmp(kind, "comm") == 0) {
+		if (val[0] == '\0') {
+			fprintf(stderr, "Missing COMM in filter control command\n");
+			return;
+		}
+		err = filters__set_comm(f, val, action);
+	} else if (strcmp(kind, "cgroup") == 0) {
+		if (val[0] == '\0') {
+			fprintf(stderr, "Missing cgroup path in filter control command\n");
+			return;
+		}
+		if (f->cgroups_fd < 0) {
+			fprintf(stderr, "Cgroup filters can be changed only if retsnoop was started with --cgroup or --no-cgroup\n");
+			return;
+		}
+		err = filters__set_cgroup(f, val, action);
+	} else {
+		fprintf(stderr, "Unrecognized filter kind '%s'\n", kind);
+		return;
+	}
+
+	if (err) {
+		fprintf(stderr, "Failed to %s %s '%s' filter: %d\n", act_str, kind, val, err);
+		return;
+	}
+
+	if (f->verbose)
+		printf("Filters updated: %s %s '%s' (generation %llu).\n",
+		       act_str, kind, val, (unsigned long long)f->state->gen);
+}
+
+int filters__poll_ctl(struct filters *f)
+{
+	char *line, *nl;
+	ssize_t n;
+	int err;
+
+	if (f->ctl_fd < 0)
+		return 0;
+
+	while (true) {
+		n = read(f->ctl_fd, f->buf + f->buf_len, CTL_BUF_SZ - f->buf_len - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			if (errno == EAGAIN)
+				return 0;
+			err = -errno;
+			fprintf(stderr, "Failed to read filter control pipe: %d\n", err);
+			return err;
+		}
+		if (n == 0)
+			return 0;
+
+		f->buf_len += n;
+		f->buf[f->buf_len] = '\0';
+
+		line = f->buf;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			process_cmd(f, line);
+			line = nl + 1;
+		}
+
+		/* keep incomplete last line, unless it can't fit anyway */
+		f->buf_len -= line - f->buf;
+		if (f->buf_len == CTL_BUF_SZ - 1) {
+			fprintf(stderr, "Filter control command is too long, ignoring.\n");
+			f->buf_len = 0;
+		}
+		memmove(f->buf, line, f->buf_len);
+	}
+}
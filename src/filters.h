@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __FILTERS_H
+#define __FILTERS_H
+
+#include <stdbool.h>
+
+/*
+ * Management of BPF-side PID, COMM, and cgroup filters.
+ *
+ * Filter sets are kept in BPF hash maps, with the number of allow and deny
+ * entries of each kind (and a generation counter) in struct filter_state,
+ * shared with BPF side through memory-mapped .bss. This allows changing
+ * filters while tracing, without reloading and reattaching BPF programs.
+ *
+ * Optionally, filters can be controlled at runtime through a named pipe,
+ * accepting one command per line:
+ *
+ *   allow|deny|remove pid PID
+ *   allow|deny|remove comm COMM
+ *   allow|deny|remove cgroup PATH
+ *
+ * Cgroups are cgroup v2 directories, either absolute paths or relative to
+ * /sys/fs/cgroup. Cgroup filter applies to all its descendant cgroups, unless
+ * a more nested cgroup has a filter of its own.
+ */
+struct filter_state;
+struct filters;
+
+/* room left in filter maps for entries added through control pipe */
+#define FILTERS_CTL_MAX_CNT 1024
+
+enum filter_action {
+	FILTER_ALLOW,
+	FILTER_DENY,
+	FILTER_REMOVE,
+};
+
+/* cgroups_fd < 0 means cgroup filtering isn't supported */
+struct filters *filters__new(int tgids_fd, int comms_fd, int cgroups_fd,
+			     struct filter_state *state, bool verbose);
+void filters__free(struct filters *f);
+
+int filters__set_pid(struct filters *f, int tgid, enum filter_action action);
+int filters__set_comm(struct filters *f, const char *comm, enum filter_action action);
+int filters__set_cgroup(struct filters *f, const char *path, enum filter_action action);
+
+/* create (if necessary) and open named pipe at path for control commands */
+int filters__open_ctl(struct filters *f, const char *path);
+/* apply all pending control commands, doesn't block */
+int filters__poll_ctl(struct filters *f);
+
+#endif /* __FILTERS_H */
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "folded.h"
+#include "hashmap.h"
+
+struct folded {
+	/* folded stack string -> accumulated weight */
+	struct hashmap *stacks;
+};
+
+static size_t stack_hasher(const void *key, void *ctx)
+{
+	return str_hash(key);
+}
+
+static bool stack_equal(const void *key1, const void *key2, void *ctx)
+{
+	return strcmp(key1, key2) == 0;
+}
+
+struct folded *folded__new(void)
+{
+	struct folded *f;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+
+	f->stacks = hashmap__new(stack_hasher, stack_equal, NULL);
+	if (!f->stacks) {
+		free(f);
+		return NULL;
+	}
+
+	return f;
+}
+
+void folded__free(struct folded *f)
+{
+	struct hashmap_entry *e;
+	size_t bkt;
+
+	if (!f)
+		return;
+
+	hashmap__for_each_entry(f->stacks, e, bkt)
+		free((void *)e->key);
+	hashmap__free(f->stacks);
+	free(f);
+}
+
+int folded__add(struct folded *f, const char *stack, long weight)
+{
+	uintptr_t w;
+	char *key;
+	int err;
+
+	if (hashmap__find(f->stacks, stack, (void **)&w))
+		return hashmap__update(f->stacks, stack, (void *)(w + weight), NULL, NULL);
+
+	key = strdup(stack);
+	if (!key)
+		return -ENOMEM;
+
+	err = hashmap__add(f->stacks, key, (void *)(uintptr_t)weight);
+	if (err)
+		free(key);
+	return err;
+}
+
+static int cmp_entries(const void *a, const void *b)
+{
+	const struct hashmap_entry *e1 = *(const struct hashmap_entry **)a;
+	const struct hashmap_entry *e2 = *(const struct hashmap_entry **)b;
+
+	return strcmp(e1->key, e2->key);
+}
+
+int folded__write(const struct folded *f, const char *path)
+{
+	struct hashmap_entry **entries = NULL, *e;
+	char tmp_path[PATH_MAX];
+	size_t bkt, cnt = 0, i;
+	int err = 0;
+	FILE *out;
+
+	entries = calloc(hashmap__size(f->stacks) + 1, sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+	hashmap__for_each_entry(f->stacks, e, bkt)
+		entries[cnt++] = e;
+	/* sorted output is stable across periodic rewrites and diff-friendly */
+	qsort(entries, cnt, sizeof(*entries), cmp_entries);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	out = fopen(tmp_path, "w");
+	if (!out) {
+		err = -errno;
+		goto out;
+	}
+
+	for (i = 0; i < cnt; i++)
+		fprintf(out, "%s %lu\n", (const char *)entries[i]->key,
+			(unsigned long)(uintptr_t)entries[i]->value);
+
+	if (ferror(out))
+		err = -EIO;
+	if (fclose(out) && !err)
+		err = -errno;
+	if (!err && rename(tmp_path, path))
+		err = -errno;
+	if (err)
+		unlink(tmp_path);
+out:
+	free(entries);
+	return err;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __FOLDED_H
+#define __FOLDED_H
+
+/*
+ * Aggregation of stacks in folded format ("outer;inner;leaf weight"), as
+ * consumed by flamegraph.pl, inferno, speedscope, and similar tools.
+ */
+struct folded;
+
+struct folded *folded__new(void);
+void folded__free(struct folded *f);
+
+/* add weight to a given ';'-separated stack, stack string is copied */
+int folded__add(struct folded *f, const char *stack, long weight);
+/* (re-)write all aggregated stacks into a file, atomically replacing it */
+int folded__write(const struct folded *f, const char *path);
+
+#endif /* __FOLDED_H */
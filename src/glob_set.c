@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "glob_set.h"
+#include "hashmap.h"
+#include "utils.h"
+
+struct gs_glob {
+	char *glob;
+	char *mod_glob;
+	/* next glob in the same trie node candidate list, or -1 */
+	int next;
+};
+
+struct trie_node {
+	int child;
+	int sibling;
+	/* smallest index of "prefix*" (or "*suffix") glob ending here, or -1 */
+	int idx;
+	/* list of globs that need full match if name reaches this node */
+	int cands;
+	char ch;
+};
+
+struct trie {
+	struct trie_node *nodes;
+	int cnt;
+	int cap;
+};
+
+struct glob_set {
+	struct gs_glob *globs;
+	int cnt;
+	int cap;
+
+	/* glob without wildcards -> its smallest index */
+	struct hashmap *exact;
+	struct trie prefixes;
+	/* suffixes are stored reversed */
+	struct trie suffixes;
+
+	/* globs matched against every name, in the order of addition */
+	int *generic;
+	int generic_cnt;
+};
+
+static size_t exact_hasher(const void *key, void *ctx)
+{
+	return str_hash(key);
+}
+
+static bool exact_equal(const void *key1, const void *key2, void *ctx)
+{
+	return strcmp(key1, key2) == 0;
+}
+
+static int trie_new_node(struct trie *t, char ch)
+{
+	struct trie_node *n;
+
+	if (t->cnt == t->cap) {
+		int new_cap = t->cap ? t->cap * 2 : 64;
+
+		n = realloc(t->nodes, new_cap * sizeof(*n));
+		if (!n)
+			return -ENOMEM;
+		t->nodes = n;
+		t->cap = new_cap;
+	}
+
+	n = &t->nodes[t->cnt];
+	n->child = n->sibling = n->idx = n->cands = -1;
+	n->ch = ch;
+
+	return t->cnt++;
+}
+
+/* find or create node for a given string, returns node index */
+static int trie_insert(struct trie *t, const char *s, int len, bool reverse)
+{
+	int i, n = 0, c;
+	char ch;
+
+	for (i = 0; i < len; i++) {
+		ch = reverse ? s[len - 1 - i] : s[i];
+		for (c = t->nodes[n].child; c >= 0; c = t->nodes[c].sibling) {
+			if (t->nodes[c].ch == ch)
+				break;
+		}
+		if (c < 0) {
+			c = trie_new_node(t, ch);
+			if (c < 0)
+				return c;
+			t->nodes[c].sibling = t->nodes[n].child;
+			t->nodes[n].child = c;
+		}
+		n = c;
+	}
+
+	return n;
+}
+
+/* walk all the nodes along name's path, updating best matching glob index */
+static void trie_match(const struct glob_set *gs, const struct trie *t,
+		       const char *name, int len, bool reverse, int *best)
+{
+	const struct trie_node *n = &t->nodes[0];
+	int i = 0, c;
+	char ch;
+
+	while (true) {
+		if (n->idx >= 0 && n->idx < *best)
+			*best = n->idx;
+		for (c = n->cands; c >= 0; c = gs->globs[c].next) {
+			if (c < *best && glob_matches(gs->globs[c].glob, name))
+				*best = c;
+		}
+
+		if (i == len)
+			break;
+
+		ch = reverse ? name[len - 1 - i] : name[i];
+		i++;
+		for (c = n->child; c >= 0; c = t->nodes[c].sibling) {
+			if (t->nodes[c].ch == ch)
+				break;
+		}
+		if (c < 0)
+			break;
+		n = &t->nodes[c];
+	}
+}
+
+struct glob_set *glob_set__new(void)
+{
+	struct glob_set *gs;
+
+	gs = calloc(1, sizeof(*gs));
+	if (!gs)
+		return NULL;
+
+	gs->exact = hashmap__new(exact_hasher, exact_equal, NULL);
+	if (!gs->exact)
+		goto err_out;
+
+	/* root nodes stand for empty prefix/suffix */
+	if (trie_new_node(&gs->prefixes, 0) < 0 || trie_new_node(&gs->suffixes, 0) < 0)
+		goto err_out;
+
+	return gs;
+
+err_out:
+	glob_set__free(gs);
+	return NULL;
+}
+
+void glob_set__free(struct glob_set *gs)
+{
+	int i;
+
+	if (!gs)
+		return;
+
+	for (i = 0; i < gs->cnt; i++) {
+		free(gs->globs[i].glob);
+		free(gs->globs[i].mod_glob);
+	}
+	free(gs->globs);
+	hashmap__free(gs->exact);
+	free(gs->prefixes.nodes);
+	free(gs->suffixes.nodes);
+	free(gs->generic);
+	free(gs);
+}
+
+static int add_generic(struct glob_set *gs, int idx)
+{
+	int *tmp;
+
+	tmp = realloc(gs->generic, (gs->generic_cnt + 1) * sizeof(*gs->generic));
+	if (!tmp)
+		return -ENOMEM;
+	gs->generic = tmp;
+	gs->generic[gs->generic_cnt++] = idx;
+
+	return 0;
+}
+
+static int add_to_trie(struct glob_set *gs, struct trie *t, const char *s, int len,
+		       bool reverse, bool is_cand, int idx)
+{
+	struct trie_node *n;
+	int i;
+
+	i = trie_insert(t, s, len, reverse);
+	if (i < 0)
+		return i;
+
+	n = &t->nodes[i];
+	if (is_cand) {
+		gs->globs[idx].next = n->cands;
+		n->cands = idx;
+	} else if (n->idx < 0) {
+		n->idx = idx;
+	}
+
+	return 0;
+}
+
+static bool all_stars(const char *s, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (s[i] != '*')
+			return false;
+	}
+	return true;
+}
+
+int glob_set__add(struct glob_set *gs, const char *glob, const char *mod_glob)
+{
+	struct gs_glob *g;
+	int idx, len, pref_len, suff_len, err;
+
+	if (gs->cnt == gs->cap) {
+		int new_cap = gs->cap ? gs->cap * 2 : 16;
+
+		g = realloc(gs->globs, new_cap * sizeof(*g));
+		if (!g)
+			return -ENOMEM;
+		gs->globs = g;
+		gs->cap = new_cap;
+	}
+
+	g = &gs->globs[gs->cnt];
+	g->glob = strdup(glob);
+	g->mod_glob = mod_glob ? strdup(mod_glob) : NULL;
+	g->next = -1;
+	if (!g->glob || (mod_glob && !g->mod_glob)) {
+		free(g->glob);
+		free(g->mod_glob);
+		return -ENOMEM;
+	}
+	idx = gs->cnt++;
+
+	/* module-qualified globs are rare, just check them one by one */
+	if (mod_glob)
+		return add_generic(gs, idx) ?: idx;
+
+	len = strlen(glob);
+	pref_len = strcspn(glob, "*?");
+	if (pref_len == len) {
+		err = hashmap__add(gs->exact, g->glob, (void *)(uintptr_t)idx);
+		/* earlier duplicate glob takes precedence */
+		if (err && err != -EEXIST)
+			return err;
+		return idx;
+	}
+
+	for (suff_len = 0; suff_len < len; suff_len++) {
+		char c = glob[len - 1 - suff_len];
+
+		if (c == '*' || c == '?')
+			break;
+	}
+
+	if (all_stars(glob + pref_len, len - pref_len))
+		err = add_to_trie(gs, &gs->prefixes, glob, pref_len, false, false, idx);
+	else if (pref_len == 0 && all_stars(glob, len - suff_len))
+		err = add_to_trie(gs, &gs->suffixes, glob + len - suff_len, suff_len, true, false, idx);
+	else if (pref_len > 0)
+		err = add_to_trie(gs, &gs->prefixes, glob, pref_len, false, true, idx);
+	else if (suff_len > 0)
+		err = add_to_trie(gs, &gs->suffixes, glob + len - suff_len, suff_len, true, true, idx);
+	else
+		err = add_generic(gs, idx);
+
+	return err ?: idx;
+}
+
+int glob_set__match(const struct glob_set *gs, const char *name, const char *mod)
+{
+	const struct gs_glob *g;
+	int best = INT_MAX, len, i;
+	void *val;
+
+	if (hashmap__find(gs->exact, name, &val))
+		best = (uintptr_t)val;
+
+	len = strlen(name);
+	trie_match(gs, &gs->prefixes, name, len, false, &best);
+	trie_match(gs, &gs->suffixes, name, len, true, &best);
+
+	/* generic globs are in increasing index order */
+	for (i = 0; i < gs->generic_cnt && gs->generic[i] < best; i++) {
+		g = &gs->globs[gs->generic[i]];
+		if (full_glob_matches(g->glob, g->mod_glob, name, mod)) {
+			best = gs->generic[i];
+			break;
+		}
+	}
+
+	return best == INT_MAX ? -1 : best;
+}
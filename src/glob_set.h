@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __GLOB_SET_H
+#define __GLOB_SET_H
+
+/*
+ * Set of (name glob, optional module glob) pairs, indexed for matching lots
+ * of function names against lots of globs.
+ *
+ * Globs without wildcards go into an exact name hash set, "prefix*" and
+ * "*suffix" globs into prefix and suffix tries. Other globs are matched
+ * with glob_matches(), but only if their literal prefix or suffix (if any)
+ * matches, as found through the same tries. Only globs without any literal
+ * prefix or suffix (e.g., "*foo*") and globs with module glob are checked
+ * against every name.
+ *
+ * Globs are identified by their 0-based index in the order of addition.
+ */
+struct glob_set;
+
+struct glob_set *glob_set__new(void);
+void glob_set__free(struct glob_set *gs);
+
+/* glob strings are copied, returns index of added glob or negative error */
+int glob_set__add(struct glob_set *gs, const char *glob, const char *mod_glob);
+
+/* returns index of the first added glob matching name and module, or -1 */
+int glob_set__match(const struct glob_set *gs, const char *name, const char *mod);
+
+#endif /* __GLOB_SET_H */
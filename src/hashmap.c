@@ -266,3 +266,147 @@ bool hashmap__delete(struct hashmap *map, const void *key,
 
 	return true;
 }
+
+/* start with 16 slots */
+#define INT_HASHMAP_MIN_CAP_BITS 4
+
+struct int_hashmap *int_hashmap__new(void)
+{
+	return calloc(1, sizeof(struct int_hashmap));
+}
+
+void int_hashmap__clear(struct int_hashmap *map)
+{
+	free(map->slots);
+	map->slots = NULL;
+	map->cap = map->cap_bits = map->sz = 0;
+}
+
+void int_hashmap__free(struct int_hashmap *map)
+{
+	if (!map)
+		return;
+
+	int_hashmap__clear(map);
+	free(map);
+}
+
+static size_t int_hashmap_slot(const struct int_hashmap *map, long key)
+{
+	return hash_bits((size_t)key, map->cap_bits);
+}
+
+/* find slot holding key, or the empty slot where it would be inserted */
+static size_t int_hashmap_probe(const struct int_hashmap *map, long key)
+{
+	size_t mask = map->cap - 1, i;
+
+	for (i = int_hashmap_slot(map, key); ; i = (i + 1) & mask) {
+		if (map->slots[i].key == key || map->slots[i].key == INT_HASHMAP_EMPTY_KEY)
+			return i;
+	}
+}
+
+static int int_hashmap_grow(struct int_hashmap *map)
+{
+	struct int_hashmap_entry *old_slots = map->slots, *slot;
+	size_t old_cap = map->cap, new_cap_bits, i;
+
+	new_cap_bits = map->cap ? map->cap_bits + 1 : INT_HASHMAP_MIN_CAP_BITS;
+	slot = malloc(sizeof(*slot) << new_cap_bits);
+	if (!slot)
+		return -ENOMEM;
+
+	map->slots = slot;
+	map->cap_bits = new_cap_bits;
+	map->cap = 1UL << new_cap_bits;
+	for (i = 0; i < map->cap; i++)
+		map->slots[i].key = INT_HASHMAP_EMPTY_KEY;
+
+	for (i = 0; i < old_cap; i++) {
+		if (old_slots[i].key == INT_HASHMAP_EMPTY_KEY)
+			continue;
+		map->slots[int_hashmap_probe(map, old_slots[i].key)] = old_slots[i];
+	}
+
+	free(old_slots);
+	return 0;
+}
+
+int int_hashmap__add(struct int_hashmap *map, long key, void *value)
+{
+	size_t i = 0;
+	int err;
+
+	if (key == INT_HASHMAP_EMPTY_KEY)
+		return -EINVAL;
+
+	if (map->cap) {
+		i = int_hashmap_probe(map, key);
+		if (map->slots[i].key == key)
+			return -EEXIST;
+	}
+
+	/* keep load factor at or below 3/4 */
+	if (!map->cap || (map->sz + 1) * 4 > map->cap * 3) {
+		err = int_hashmap_grow(map);
+		if (err)
+			return err;
+		i = int_hashmap_probe(map, key);
+	}
+
+	map->slots[i].key = key;
+	map->slots[i].value = value;
+	map->sz++;
+
+	return 0;
+}
+
+bool int_hashmap__find(const struct int_hashmap *map, long key, void **value)
+{
+	size_t i;
+
+	if (!map->cap || key == INT_HASHMAP_EMPTY_KEY)
+		return false;
+
+	i = int_hashmap_probe(map, key);
+	if (map->slots[i].key != key)
+		return false;
+
+	if (value)
+		*value = map->slots[i].value;
+	return true;
+}
+
+bool int_hashmap__delete(struct int_hashmap *map, long key, void **old_value)
+{
+	size_t mask = map->cap - 1, i, j, home;
+
+	if (!map->cap || key == INT_HASHMAP_EMPTY_KEY)
+		return false;
+
+	i = int_hashmap_probe(map, key);
+	if (map->slots[i].key != key)
+		return false;
+
+	if (old_value)
+		*old_value = map->slots[i].value;
+
+	/* shift back following entries of the same probe run, so that the
+	 * run has no holes and lookups can stop at the first empty slot
+	 */
+	for (j = (i + 1) & mask; map->slots[j].key != INT_HASHMAP_EMPTY_KEY; j = (j + 1) & mask) {
+		home = int_hashmap_slot(map, map->slots[j].key);
+		/* entry at j can move to i only if its home slot is not
+		 * within (i, j] cyclically
+		 */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			map->slots[i] = map->slots[j];
+			i = j;
+		}
+	}
+	map->slots[i].key = INT_HASHMAP_EMPTY_KEY;
+	map->sz--;
+
+	return true;
+}
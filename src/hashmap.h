@@ -192,4 +192,56 @@ bool hashmap__find(const struct hashmap *map, const void *key, void **value);
 	     cur = tmp)							    \
 		if (map->equal_fn(cur->key, (_key), map->ctx))
 
+/*
+ * Open-addressing hash map with integer keys and pointer values stored
+ * inline in a single array of slots. Lookups don't chase pointers and
+ * insertions don't allocate, except for growing the slot array. Collisions
+ * are resolved with linear probing, deletions use backward shifting, so
+ * there are no tombstones and probe sequences stay short under churn.
+ *
+ * This only pays off for large key sets that don't fit in cache; up to a few
+ * thousand keys the chained hashmap above is just as fast or faster (see
+ * tests/hashmap_bench.c), so prefer it unless key set is known to be large.
+ *
+ * INT_HASHMAP_EMPTY_KEY is reserved to mark empty slots and can't be used
+ * as a key.
+ */
+#define INT_HASHMAP_EMPTY_KEY LONG_MIN
+
+struct int_hashmap_entry {
+	long key;
+	void *value;
+};
+
+struct int_hashmap {
+	struct int_hashmap_entry *slots;
+	size_t cap;
+	size_t cap_bits;
+	size_t sz;
+};
+
+struct int_hashmap *int_hashmap__new(void);
+void int_hashmap__clear(struct int_hashmap *map);
+void int_hashmap__free(struct int_hashmap *map);
+
+static inline size_t int_hashmap__size(const struct int_hashmap *map)
+{
+	return map->sz;
+}
+
+/* add key/value pair, return -EEXIST if key is already present */
+int int_hashmap__add(struct int_hashmap *map, long key, void *value);
+bool int_hashmap__find(const struct int_hashmap *map, long key, void **value);
+bool int_hashmap__delete(struct int_hashmap *map, long key, void **old_value);
+
+/*
+ * int_hashmap__for_each_entry - iterate over all entries in int_hashmap
+ * @map: int_hashmap to iterate
+ * @cur: struct int_hashmap_entry * used as a loop cursor
+ * @i: size_t slot index cursor
+ */
+#define int_hashmap__for_each_entry(map, cur, i)			    \
+	for (i = 0; i < (map)->cap; i++)				    \
+		if ((cur = &(map)->slots[i])->key != INT_HASHMAP_EMPTY_KEY)
+
 #endif /* __LIBBPF_HASHMAP_H */
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include "kernel_features.h"
+#include "cache.h"
+#include "calib_feat.skel.h"
+
+#define FEATURES_CACHE_NAME "features"
+/* bump whenever detected features or their semantics change */
+#define FEATURES_CACHE_VERSION 3
+
+static struct kernel_features feats_memo;
+static bool feats_detected;
+
+/* kernel features are fixed for a given boot of a given kernel */
+static int features_cache_key(char *buf, size_t buf_sz)
+{
+	char boot_id[64] = {};
+	struct utsname u;
+	FILE *f;
+
+	if (uname(&u))
+		return -errno;
+
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!f)
+		return -errno;
+	if (fscanf(f, "%63s", boot_id) != 1) {
+		fclose(f);
+		return -EINVAL;
+	}
+	fclose(f);
+
+	snprintf(buf, buf_sz, "v%d %s %s", FEATURES_CACHE_VERSION, u.release, boot_id);
+	return 0;
+}
+
+static int load_cached_features(struct kernel_features *feats)
+{
+	char key[512], *data = NULL, *p;
+	int has[8], kret_ip_off, n = 0, err;
+	size_t sz;
+
+	err = features_cache_key(key, sizeof(key));
+	if (err)
+		return err;
+
+	err = cache__read(FEATURES_CACHE_NAME, (void **)&data, &sz);
+	if (err)
+		return err;
+
+	/* first line is the key, second line has all the results */
+	p = memchr(data, '\n', sz);
+	if (!p || p - data != strlen(key) || memcmp(data, key, p - data) != 0) {
+		err = -ESTALE;
+		goto out;
+	}
+	p++;
+	if (sz - (p - data) >= 128 || !memchr(p, '\n', sz - (p - data))) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (sscanf(p, "%d %d %d %d %d %d %d %d %d\n%n",
+		   &has[0], &has[1], &has[2], &has[3], &has[4], &has[5], &has[6], &has[7],
+		   &kret_ip_off, &n) != 9 || n == 0) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	feats->has_ringbuf = has[0];
+	feats->has_bpf_get_func_ip = has[1];
+	feats->has_branch_snapshot = has[2];
+	feats->has_bpf_cookie = has[3];
+	feats->has_kprobe_multi = has[4];
+	feats->has_fexit_sleep_fix = has[5];
+	feats->has_fentry_protection = has[6];
+	feats->has_ancestor_cgroup_id = has[7];
+	feats->kret_ip_off = kret_ip_off;
+	feats->cached = true;
+
+out:
+	free(data);
+	return err;
+}
+
+static void save_cached_features(const struct kernel_features *feats)
+{
+	char key[512], buf[1024];
+	int n;
+
+	if (features_cache_key(key, sizeof(key)))
+		return;
+
+	n = snprintf(buf, sizeof(buf), "%s\n%d %d %d %d %d %d %d %d %d\n", key,
+		     feats->has_ringbuf, feats->has_bpf_get_func_ip,
+		     feats->has_branch_snapshot, feats->has_bpf_cookie,
+		     feats->has_kprobe_multi, feats->has_fexit_sleep_fix,
+		     feats->has_fentry_protection, feats->has_ancestor_cgroup_id,
+		     feats->kret_ip_off);
+	if (n > 0 && n < sizeof(buf))
+		cache__write(FEATURES_CACHE_NAME, buf, n);
+}
+
+/* Helper itself predates its availability to kprobe/fentry programs, so
+ * existence of BPF_FUNC_get_current_ancestor_cgroup_id in kernel BTF is not
+ * enough. Instead try loading a kprobe program calling it, kprobe and
+ * tracing programs share the same set of tracing helpers.
+ */
+static bool probe_ancestor_cgroup_id(void)
+{
+	struct bpf_insn insns[] = {
+		/* r1 = 0; call bpf_get_current_ancestor_cgroup_id */
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_1, .imm = 0 },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_get_current_ancestor_cgroup_id },
+		/* r0 = 0; exit */
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = 0 },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+	int fd;
+
+	fd = bpf_prog_load(BPF_PROG_TYPE_KPROBE, "probe_cgid", "Dual BSD/GPL",
+			   insns, sizeof(insns) / sizeof(insns[0]), NULL);
+	if (fd < 0)
+		return false;
+
+	close(fd);
+	return true;
+}
+
+static int detect_features(struct kernel_features *feats)
+{
+	struct calib_feat_bpf *skel;
+	int err;
+
+	skel = calib_feat_bpf__open_and_load();
+	if (!skel) {
+		err = -errno;
+		fprintf(stderr, "Failed to load feature detection skeleton.\n");
+		return err;
+	}
+
+	if (!skel->bss) {
+		fprintf(stderr, "Kernel doesn't support memory mapping BPF global vars, you might need newer Linux kernel.\n");
+		err = -EOPNOTSUPP;
+		goto out;
+	}
+
+	skel->bss->my_tid = syscall(SYS_gettid);
+
+	err = calib_feat_bpf__attach(skel);
+	if (err) {
+		fprintf(stderr, "Failed to attach feature detection skeleton.\n");
+		goto out;
+	}
+
+	usleep(1);
+
+	if (!skel->bss->has_bpf_get_func_ip && skel->bss->kret_ip_off == 0) {
+		fprintf(stderr, "Failed to calibrate kretprobe func IP extraction.\n");
+		err = -EFAULT;
+		goto out;
+	}
+
+	memset(feats, 0, sizeof(*feats));
+	feats->has_ringbuf = skel->bss->has_ringbuf;
+	feats->has_bpf_get_func_ip = skel->bss->has_bpf_get_func_ip;
+	feats->has_branch_snapshot = skel->bss->has_branch_snapshot;
+	feats->has_bpf_cookie = skel->bss->has_bpf_cookie;
+	feats->has_kprobe_multi = skel->bss->has_kprobe_multi;
+	feats->has_fexit_sleep_fix = skel->bss->has_fexit_sleep_fix;
+	feats->has_fentry_protection = skel->bss->has_fentry_protection;
+	feats->has_ancestor_cgroup_id = probe_ancestor_cgroup_id();
+	feats->kret_ip_off = skel->bss->kret_ip_off;
+
+out:
+	calib_feat_bpf__destroy(skel);
+	return err;
+}
+
+int kernel_features__get(struct kernel_features *feats, bool recalibrate)
+{
+	int err;
+
+	if (feats_detected) {
+		*feats = feats_memo;
+		return 0;
+	}
+
+	if (recalibrate || load_cached_features(&feats_memo) != 0) {
+		err = detect_features(&feats_memo);
+		if (err)
+			return err;
+		save_cached_features(&feats_memo);
+	}
+
+	feats_detected = true;
+	*feats = feats_memo;
+	return 0;
+}
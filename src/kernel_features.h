@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __KERNEL_FEATURES_H
+#define __KERNEL_FEATURES_H
+
+#include <stdbool.h>
+
+/* kernel features detected and calibrated with calib_feat BPF skeleton */
+struct kernel_features {
+	bool has_ringbuf;
+	bool has_bpf_get_func_ip;
+	bool has_branch_snapshot;
+	bool has_bpf_cookie;
+	bool has_kprobe_multi;
+	bool has_ancestor_cgroup_id;
+	bool has_fexit_sleep_fix;
+	bool has_fentry_protection;
+	int kret_ip_off;
+
+	/* results came from on-disk cache */
+	bool cached;
+};
+
+/*
+ * Detect kernel features. This requires loading and triggering BPF programs,
+ * but results can't change until reboot, so they are cached on disk keyed by
+ * kernel release and boot ID, and are reused within the same process. With
+ * recalibrate == true, detection is always performed (once per process) and
+ * the cache is refreshed.
+ */
+int kernel_features__get(struct kernel_features *feats, bool recalibrate);
+
+#endif /* __KERNEL_FEATURES_H */
@@ -6,10 +6,13 @@
 #include <ctype.h>
 #include <time.h>
 #include "ksyms.h"
+#include "hashmap.h"
 
 struct ksyms {
 	struct ksym *syms;
-	struct ksym **syms_by_name;
+	/* open addressing hash table of symbol indices (or -1), by name */
+	int *name_idx;
+	int name_idx_bits;
 	int syms_sz;
 	int syms_cap;
 	char *strs;
@@ -82,29 +85,50 @@ static int ksym_cmp(const void *p1, const void *p2)
 	return s1->addr < s2->addr ? -1 : 1;
 }
 
-static int ksym_by_name_cmp(const void *p1, const void *p2)
+/* index symbols by name; for duplicate names, symbol with lowest address
+ * wins, so has to be called after sorting symbols by address
+ */
+static int ksyms__build_name_idx(struct ksyms *ksyms)
 {
-	const struct ksym * const *sp1 = p1, * const *sp2 = p2;
-	const struct ksym *s1 = *sp1, *s2 = *sp2;
+	unsigned int cap, h, mask;
+	int i, j;
 
-	return strcmp(s1->name, s2->name);
+	ksyms->name_idx_bits = 10;
+	while ((1U << ksyms->name_idx_bits) < ksyms->syms_sz * 2U)
+		ksyms->name_idx_bits++;
+	cap = 1U << ksyms->name_idx_bits;
+	mask = cap - 1;
+
+	ksyms->name_idx = malloc(cap * sizeof(*ksyms->name_idx));
+	if (!ksyms->name_idx)
+		return -1;
+	memset(ksyms->name_idx, 0xff, cap * sizeof(*ksyms->name_idx));
+
+	for (i = 0; i < ksyms->syms_sz; i++) {
+		h = hash_bits(str_hash(ksyms->syms[i].name), ksyms->name_idx_bits);
+		while ((j = ksyms->name_idx[h]) >= 0) {
+			if (strcmp(ksyms->syms[j].name, ksyms->syms[i].name) == 0)
+				break;
+			h = (h + 1) & mask;
+		}
+		if (j < 0)
+			ksyms->name_idx[h] = i;
+	}
+
+	return 0;
 }
 
-struct ksyms *ksyms__load(void)
+/* parse /proc/kallsyms-formatted contents of f */
+static struct ksyms *ksyms__parse(FILE *f)
 {
 	char sym_type, sym_name[256], mod_buf[128], *mod_name;
 	struct ksyms *ksyms;
 	unsigned long sym_addr;
 	int i, ret;
-	FILE *f;
-
-	f = fopen("/proc/kallsyms", "r");
-	if (!f)
-		return NULL;
 
 	ksyms = calloc(1, sizeof(*ksyms));
 	if (!ksyms)
-		goto err_out;
+		return NULL;
 
 	while (true) {
 		ret = fscanf(f, "%lx %c %s%[^\n]\n",
@@ -126,22 +150,18 @@ struct ksyms *ksyms__load(void)
 		if (ksyms__add_symbol(ksyms, sym_name, mod_name, sym_addr, sym_type))
 			goto err_out;
 	}
-	fclose(f);
-
-	ksyms->syms_by_name = calloc(ksyms->syms_sz, sizeof(*ksyms->syms_by_name));
-	if (!ksyms->syms_by_name)
-		goto err_out;
 
 	/* now when strings are finalized, adjust pointers properly */
 	for (i = 0; i < ksyms->syms_sz; i++) {
 		ksyms->syms[i].name += (unsigned long)ksyms->strs;
 		if (ksyms->syms[i].module)
 			ksyms->syms[i].module += (unsigned long)ksyms->strs;
-		ksyms->syms_by_name[i] = &ksyms->syms[i];
 	}
 
 	qsort(ksyms->syms, ksyms->syms_sz, sizeof(*ksyms->syms), ksym_cmp);
-	qsort(ksyms->syms_by_name, ksyms->syms_sz, sizeof(*ksyms->syms_by_name), ksym_by_name_cmp);
+
+	if (ksyms__build_name_idx(ksyms))
+		goto err_out;
 
 	/* do another pass to calculate (guess?) function sizes */
 	for (i = 0; i < ksyms->syms_sz; i++) {
@@ -161,16 +181,50 @@ struct ksyms *ksyms__load(void)
 
 err_out:
 	ksyms__free(ksyms);
-	fclose(f);
 	return NULL;
 }
 
+struct ksyms *ksyms__load(void)
+{
+	struct ksyms *ksyms;
+	FILE *f;
+
+	f = fopen("/proc/kallsyms", "r");
+	if (!f)
+		return NULL;
+
+	ksyms = ksyms__parse(f);
+	fclose(f);
+
+	return ksyms;
+}
+
+/* load symbols from a previously captured /proc/kallsyms snapshot */
+struct ksyms *ksyms__load_buf(const char *buf, size_t buf_sz)
+{
+	struct ksyms *ksyms;
+	FILE *f;
+
+	if (buf_sz == 0)
+		return NULL;
+
+	f = fmemopen((void *)buf, buf_sz, "r");
+	if (!f)
+		return NULL;
+
+	ksyms = ksyms__parse(f);
+	fclose(f);
+
+	return ksyms;
+}
+
 void ksyms__free(struct ksyms *ksyms)
 {
 	if (!ksyms)
 		return;
 
 	free(ksyms->syms);
+	free(ksyms->name_idx);
 	free(ksyms->strs);
 	free(ksyms);
 }
@@ -200,15 +254,25 @@ const struct ksym *ksyms__map_addr(const struct ksyms *ksyms,
 const struct ksym *ksyms__get_symbol(const struct ksyms *ksyms,
 				     const char *name)
 {
-	struct ksym ksym = { .name = name };
-	struct ksym *key = &ksym;
-	const struct ksym **res;
-
-	res = bsearch(&key, ksyms->syms_by_name,
-		      ksyms->syms_sz, sizeof(*ksyms->syms_by_name),
-		      ksym_by_name_cmp);
-	if (res)
-		return *res;
+	unsigned int h, mask = (1U << ksyms->name_idx_bits) - 1;
+	int i;
+
+	h = hash_bits(str_hash(name), ksyms->name_idx_bits);
+	while ((i = ksyms->name_idx[h]) >= 0) {
+		if (strcmp(ksyms->syms[i].name, name) == 0)
+			return &ksyms->syms[i];
+		h = (h + 1) & mask;
+	}
 
 	return NULL;
 }
+
+int ksyms__sym_cnt(const struct ksyms *ksyms)
+{
+	return ksyms->syms_sz;
+}
+
+int ksyms__sym_id(const struct ksyms *ksyms, const struct ksym *ksym)
+{
+	return ksym - ksyms->syms;
+}
@@ -2,6 +2,8 @@
 #ifndef __KSYMS_H
 #define __KSYMS_H
 
+#include <stddef.h>
+
 struct ksym {
 	const char *name;
 	const char *module;
@@ -12,10 +14,17 @@ struct ksym {
 struct ksyms;
 
 struct ksyms *ksyms__load(void);
+struct ksyms *ksyms__load_buf(const char *buf, size_t buf_sz);
 void ksyms__free(struct ksyms *ksyms);
 const struct ksym *ksyms__map_addr(const struct ksyms *ksyms,
 				   unsigned long addr);
 const struct ksym *ksyms__get_symbol(const struct ksyms *ksyms,
 				     const char *name);
 
+/* symbols are identified by dense IDs in [0, ksyms__sym_cnt()) range, which
+ * allows callers to associate extra data with symbols in plain arrays
+ */
+int ksyms__sym_cnt(const struct ksyms *ksyms);
+int ksyms__sym_id(const struct ksyms *ksyms, const struct ksym *ksym);
+
 #endif /* __KSYMS_H */
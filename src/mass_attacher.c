@@ -6,14 +6,17 @@
 #include <bpf/bpf.h>
 #include <stdlib.h>
 #include <sys/resource.h>
-#include <sys/syscall.h>
 #include <linux/perf_event.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "mass_attacher.h"
 #include "ksyms.h"
-#include "calib_feat.skel.h"
+#include "kernel_features.h"
 #include "utils.h"
+#include "glob_set.h"
+#include "cache.h"
+#include "startup_prof.h"
 
 #ifndef SKEL_NAME
 #error "Please define -DSKEL_NAME=<BPF skeleton name> for mass_attacher"
@@ -80,13 +83,15 @@ static const char *sleepable_deny_globs[] = {
 };
 
 #define MAX_FUNC_ARG_CNT 6
+/* upper bound on threads used to scan vmlinux BTF functions */
+#define MAX_SCAN_THREADS 16
 
 struct mass_attacher;
 
 static _Thread_local struct mass_attacher *cur_attacher;
 
 struct kprobe_info {
-	char *name;
+	const char *name;
 	bool used;
 };
 
@@ -125,15 +130,23 @@ struct mass_attacher {
 
 	struct mass_attacher_func_info *func_infos;
 	int func_cnt;
+	int func_info_cap;
 
 	int func_info_cnts[MAX_FUNC_ARG_CNT + 1];
 	int func_info_id_for_arg_cnt[MAX_FUNC_ARG_CNT + 1];
 
 	struct kprobe_info *kprobes;
 	int kprobe_cnt;
+	/* contents of available_filter_functions, kprobe names point into it */
+	char *kprobe_strs;
+	/* ksym ID -> index of its kprobe, or -1 */
+	int *sym_kprobes;
 
 	int func_skip_cnt;
 
+	bool plan_cache;
+	bool plan_cached;
+
 	int allow_glob_cnt;
 	int deny_glob_cnt;
 	struct {
@@ -141,6 +154,8 @@ struct mass_attacher {
 		char *mod_glob;
 		int matches;
 	} *allow_globs, *deny_globs;
+	/* indexed copies of allow/deny globs, in the same order */
+	struct glob_set *allow_set, *deny_set;
 };
 
 struct mass_attacher *mass_attacher__new(struct SKEL_NAME *skel, struct ksyms *ksyms,
@@ -159,6 +174,13 @@ struct mass_attacher *mass_attacher__new(struct SKEL_NAME *skel, struct ksyms *k
 	att->skel = skel;
 	att->ksyms = ksyms;
 
+	att->allow_set = glob_set__new();
+	att->deny_set = glob_set__new();
+	if (!att->allow_set || !att->deny_set) {
+		mass_attacher__free(att);
+		return NULL;
+	}
+
 	if (!opts)
 		return att;
 
@@ -173,6 +195,7 @@ struct mass_attacher *mass_attacher__new(struct SKEL_NAME *skel, struct ksyms *k
 	att->attach_mode = opts->attach_mode;
 	att->use_fentries = opts->attach_mode == MASS_ATTACH_FENTRY;
 	att->func_filter = opts->func_filter;
+	att->plan_cache = opts->plan_cache;
 
 	for (i = 0; i < ARRAY_SIZE(enforced_deny_globs); i++) {
 		err = mass_attacher__deny_glob(att, enforced_deny_globs[i], NULL);
@@ -214,11 +237,12 @@ void mass_attacher__free(struct mass_attacher *att)
 
 	free(att->func_infos);
 
-	if (att->kprobes) {
-		for (i = 0; i < att->kprobe_cnt; i++)
-			free(att->kprobes[i].name);
-		free(att->kprobes);
-	}
+	glob_set__free(att->allow_set);
+	glob_set__free(att->deny_set);
+
+	free(att->kprobes);
+	free(att->kprobe_strs);
+	free(att->sym_kprobes);
 
 	for (i = 0; i <= MAX_FUNC_ARG_CNT; i++) {
 		free(att->fentries_insns[i]);
@@ -257,6 +281,7 @@ static bool is_valid_glob(const char *glob)
 int mass_attacher__allow_glob(struct mass_attacher *att, const char *glob, const char *mod_glob)
 {
 	void *tmp, *s1, *s2 = NULL;
+	int err;
 
 	if (!is_valid_glob(glob))
 		return -EINVAL;
@@ -279,6 +304,13 @@ int mass_attacher__allow_glob(struct mass_attacher *att, const char *glob, const
 		}
 	}
 
+	err = glob_set__add(att->allow_set, glob, mod_glob);
+	if (err < 0) {
+		free(s1);
+		free(s2);
+		return err;
+	}
+
 	att->allow_globs[att->allow_glob_cnt].glob = s1;
 	att->allow_globs[att->allow_glob_cnt].mod_glob = s2;
 	att->allow_globs[att->allow_glob_cnt].matches = 0;
@@ -290,6 +322,7 @@ int mass_attacher__allow_glob(struct mass_attacher *att, const char *glob, const
 int mass_attacher__deny_glob(struct mass_attacher *att, const char *glob, const char *mod_glob)
 {
 	void *tmp, *s1, *s2 = NULL;
+	int err;
 
 	if (!is_valid_glob(glob))
 		return -EINVAL;
@@ -312,6 +345,13 @@ int mass_attacher__deny_glob(struct mass_attacher *att, const char *glob, const
 		}
 	}
 
+	err = glob_set__add(att->deny_set, glob, mod_glob);
+	if (err < 0) {
+		free(s1);
+		free(s2);
+		return err;
+	}
+
 	att->deny_globs[att->deny_glob_cnt].glob = s1;
 	att->deny_globs[att->deny_glob_cnt].mod_glob = s2;
 	att->deny_globs[att->deny_glob_cnt].matches = 0;
@@ -324,18 +364,28 @@ static int bump_rlimit(int resource, rlim_t max);
 static int load_available_kprobes(struct mass_attacher *attacher);
 
 static int func_arg_cnt(const struct btf *btf, int id);
-static int find_kprobe(const struct mass_attacher *att, const char *name);
+static int find_kprobe(const struct mass_attacher *att, const struct ksym *ksym);
 static bool is_func_type_ok(const struct btf *btf, const struct btf_type *t);
 static int prepare_func(struct mass_attacher *att, const char *func_name,
 			const struct btf_type *t, int btf_id);
+static int prepare_btf_funcs(struct mass_attacher *att);
+static int load_cached_plan(struct mass_attacher *att);
+static void save_cached_plan(struct mass_attacher *att);
 static int calibrate_features(struct mass_attacher *att);
 
 int mass_attacher__prepare(struct mass_attacher *att)
 {
-	int err, i, n;
+	uint64_t ts;
+	int err, i;
 
-	/* Load and cache /proc/kallsyms for IP <-> kfunc mapping */
-	att->ksyms = ksyms__load();
+	/* Load and cache /proc/kallsyms for IP <-> kfunc mapping, unless
+	 * caller already did that
+	 */
+	if (!att->ksyms) {
+		ts = startup_prof__ts();
+		att->ksyms = ksyms__load();
+		startup_prof__phase("ksyms_load", ts);
+	}
 	if (!att->ksyms) {
 		fprintf(stderr, "Failed to load /proc/kallsyms\n");
 		return -EINVAL;
@@ -381,13 +431,6 @@ int mass_attacher__prepare(struct mass_attacher *att)
 	att->skel->rodata->has_bpf_get_func_ip = att->has_bpf_get_func_ip;
 	att->skel->rodata->has_bpf_cookie = att->has_bpf_cookie;
 
-	/* Load names of possible kprobes */
-	err = load_available_kprobes(att);
-	if (err) {
-		fprintf(stderr, "Failed to read the list of available kprobes: %d\n", err);
-		return err;
-	}
-
 	_Static_assert(MAX_FUNC_ARG_CNT == 6, "Unexpected maximum function arg count");
 	att->fentries[0] = att->skel->progs.fentry0;
 	att->fentries[1] = att->skel->progs.fentry1;
@@ -411,27 +454,40 @@ int mass_attacher__prepare(struct mass_attacher *att)
 	att->fexit_voids[5] = att->skel->progs.fexit_void5;
 	att->fexit_voids[6] = att->skel->progs.fexit_void6;
 
+	ts = startup_prof__ts();
 	att->vmlinux_btf = libbpf_find_kernel_btf();
+	startup_prof__phase("btf_load", ts);
 	err = libbpf_get_error(att->vmlinux_btf);
 	if (err) {
 		fprintf(stderr, "Failed to load vmlinux BTF: %d\n", err);
 		return -EINVAL;
 	}
 
-	n = btf__type_cnt(att->vmlinux_btf);
-	for (i = 1; i < n; i++) {
-		const struct btf_type *t = btf__type_by_id(att->vmlinux_btf, i);
-		const char *func_name;
-
-		if (!btf_is_func(t))
-			continue;
-
-		func_name = btf__str_by_offset(att->vmlinux_btf, t->name_off);
+	/* Load names of possible kprobes, cached plan is validated against
+	 * them as well
+	 */
+	ts = startup_prof__ts();
+	err = load_available_kprobes(att);
+	startup_prof__phase("available_kprobes", ts);
+	if (err) {
+		fprintf(stderr, "Failed to read the list of available kprobes: %d\n", err);
+		return err;
+	}
 
-		err = prepare_func(att, func_name, t, i);
-		if (err)
-			return err;
+	if (att->plan_cache) {
+		ts = startup_prof__ts();
+		err = load_cached_plan(att);
+		startup_prof__phase("plan_cache_load", ts);
+		if (err == 0) {
+			att->plan_cached = true;
+			goto plan_ready;
+		}
 	}
+
+	ts = startup_prof__ts();
+	err = prepare_btf_funcs(att);
+	if (err)
+		return err;
 	if (!att->use_fentries) {
 		for (i = 0; i < att->kprobe_cnt; i++) {
 			if (att->kprobes[i].used)
@@ -442,6 +498,12 @@ int mass_attacher__prepare(struct mass_attacher *att)
 				return err;
 		}
 	}
+	startup_prof__phase("btf_scan", ts);
+
+	if (att->plan_cache && att->func_cnt > 0)
+		save_cached_plan(att);
+
+plan_ready:
 
 	if (att->func_cnt == 0) {
 		fprintf(stderr, "No matching functions found.\n");
@@ -485,7 +547,8 @@ int mass_attacher__prepare(struct mass_attacher *att)
 		printf("Found %d attachable functions in total.\n", att->func_cnt);
 		printf("Skipped %d functions in total.\n", att->func_skip_cnt);
 
-		if (att->debug) {
+		/* per-glob stats are not available for cached plan */
+		if (att->debug && !att->plan_cached) {
 			for (i = 0; i < att->deny_glob_cnt; i++) {
 				printf("Deny glob '%s' matched %d functions.\n",
 				       att->deny_globs[i].glob, att->deny_globs[i].matches);
@@ -507,126 +570,162 @@ int mass_attacher__prepare(struct mass_attacher *att)
 
 static int calibrate_features(struct mass_attacher *att)
 {
-	struct calib_feat_bpf *calib_skel;
+	struct kernel_features feats;
 	int err;
 
-	calib_skel = calib_feat_bpf__open_and_load();
-	if (!calib_skel) {
-		fprintf(stderr, "Failed to load feature calibration skeleton\n");
-		return -EFAULT;
-	}
-
-	calib_skel->bss->my_tid = syscall(SYS_gettid);
-
-	err = calib_feat_bpf__attach(calib_skel);
-	if (err) {
-		fprintf(stderr, "Failed to attach feature calibration skeleton\n");
-		calib_feat_bpf__destroy(calib_skel);
-		return -EFAULT;
-	}
-
-	usleep(1);
-
-	if (!calib_skel->bss->has_bpf_get_func_ip && calib_skel->bss->kret_ip_off == 0) {
-		fprintf(stderr, "Failed to calibrate kretprobe func IP extraction.\n");
-		return -EFAULT;
-	}
+	/* normally already detected (or loaded from cache) by the caller */
+	err = kernel_features__get(&feats, false);
+	if (err)
+		return err;
 
-	att->kret_ip_off = calib_skel->bss->kret_ip_off;
-	att->has_bpf_get_func_ip = calib_skel->bss->has_bpf_get_func_ip;
-	att->has_fexit_sleep_fix = calib_skel->bss->has_fexit_sleep_fix;
-	att->has_fentry_protection = calib_skel->bss->has_fentry_protection;
-	att->has_bpf_cookie = calib_skel->bss->has_bpf_cookie;
-	att->has_kprobe_multi = calib_skel->bss->has_kprobe_multi;
+	att->kret_ip_off = feats.kret_ip_off;
+	att->has_bpf_get_func_ip = feats.has_bpf_get_func_ip;
+	att->has_fexit_sleep_fix = feats.has_fexit_sleep_fix;
+	att->has_fentry_protection = feats.has_fentry_protection;
+	att->has_bpf_cookie = feats.has_bpf_cookie;
+	att->has_kprobe_multi = feats.has_kprobe_multi;
 
 	if (att->debug) {
-		printf("Feature calibration results:\n"
+		printf("Feature calibration results%s:\n"
 		       "\tkretprobe IP offset: %d\n"
 		       "\tfexit sleep fix: %s\n"
 		       "\tfentry re-entry protection: %s\n",
+		       feats.cached ? " (cached)" : "",
 		       att->kret_ip_off,
 		       att->has_fexit_sleep_fix ? "yes" : "no",
 		       att->has_fentry_protection ? "yes" : "no");
 	}
 
-	calib_feat_bpf__destroy(calib_skel);
 	return 0;
 }
 
-static int prepare_func(struct mass_attacher *att, const char *func_name,
-			const struct btf_type *t, int btf_id)
-{
+enum func_verdict {
+	FUNC_NO_KSYM,
+	FUNC_DENIED,
+	FUNC_NOT_ALLOWED,
+	FUNC_NO_KPROBE,
+	FUNC_BAD_PROTO,
+	FUNC_OK,
+};
+
+/* outcome of checking a single function, see scan_func() */
+struct func_scan_res {
+	const char *name;
 	const struct ksym *ksym;
-	struct mass_attacher_func_info *finfo;
-	int i, arg_cnt, kprobe_idx;
-	void *tmp;
+	int btf_id;
+	int kprobe_idx;
+	/* matched deny or allow glob, depending on verdict */
+	int glob_idx;
+	enum func_verdict verdict;
+};
 
-	ksym = ksyms__get_symbol(att->ksyms, func_name);
-	if (!ksym) {
-		if (att->verbose)
-			printf("Function '%s' not found in /proc/kallsyms! Skipping.\n", func_name);
-		att->func_skip_cnt++;
-		return 0;
+/* Perform all the (expensive) checks of whether function can and should be
+ * attached to. This doesn't modify mass_attacher state, so can be done from
+ * multiple threads in parallel.
+ */
+static void scan_func(const struct mass_attacher *att, const char *func_name,
+		      const struct btf_type *t, int btf_id, struct func_scan_res *r)
+{
+	r->name = func_name;
+	r->btf_id = btf_id;
+	r->kprobe_idx = -1;
+	r->glob_idx = -1;
+
+	r->ksym = ksyms__get_symbol(att->ksyms, func_name);
+	if (!r->ksym) {
+		r->verdict = FUNC_NO_KSYM;
+		return;
 	}
 
-	/* any deny glob forces skipping a function */
-	for (i = 0; i < att->deny_glob_cnt; i++) {
-		if (!full_glob_matches(att->deny_globs[i].glob, att->deny_globs[i].mod_glob,
-				       func_name, ksym->module))
-			continue;
-
-		att->deny_globs[i].matches++;
-
-		if (att->debug_extra)
-			printf("Function '%s' is denied by '%s' glob.\n",
-			       func_name, att->deny_globs[i].glob);
-		att->func_skip_cnt++;
-		return 0;
+	/* any deny glob forces skipping a function; as before, the first
+	 * matching glob (in order of addition) gets credited with the match
+	 */
+	r->glob_idx = glob_set__match(att->deny_set, func_name, r->ksym->module);
+	if (r->glob_idx >= 0) {
+		r->verdict = FUNC_DENIED;
+		return;
 	}
 
 	/* if any allow glob is specified, function has to match one of them */
 	if (att->allow_glob_cnt) {
-		bool found = false;
+		r->glob_idx = glob_set__match(att->allow_set, func_name, r->ksym->module);
+		if (r->glob_idx < 0) {
+			r->verdict = FUNC_NOT_ALLOWED;
+			return;
+		}
+	}
 
-		for (i = 0; i < att->allow_glob_cnt; i++) {
-			if (!full_glob_matches(att->allow_globs[i].glob, att->allow_globs[i].mod_glob,
-					       func_name, ksym->module))
-				continue;
+	r->kprobe_idx = find_kprobe(att, r->ksym);
+	if (r->kprobe_idx < 0) {
+		r->verdict = FUNC_NO_KPROBE;
+		return;
+	}
+
+	if (att->use_fentries && !is_func_type_ok(att->vmlinux_btf, t)) {
+		r->verdict = FUNC_BAD_PROTO;
+		return;
+	}
 
-			att->allow_globs[i].matches++;
-			if (att->debug_extra)
-				printf("Function '%s' is allowed by '%s' glob.\n",
-				       func_name, att->allow_globs[i].glob);
+	r->verdict = FUNC_OK;
+}
 
-			found = true;
-			break;
-		}
+/* Account for scanned function and add it to the set of attached functions,
+ * if it passed all the checks. Has to be called in a deterministic (BTF ID)
+ * order, as it assigns function IDs.
+ */
+static int add_func_info(struct mass_attacher *att, const struct ksym *ksym, int btf_id);
 
-		if (!found) {
-			if (att->debug_extra)
-				printf("Function '%s' doesn't match any allow glob, skipping.\n", func_name);
-			att->func_skip_cnt++;
-			return 0;
-		}
+static int add_func(struct mass_attacher *att, const struct func_scan_res *r)
+{
+	const char *func_name = r->name;
+	const struct ksym *ksym = r->ksym;
+	int btf_id = r->btf_id;
+
+	switch (r->verdict) {
+	case FUNC_NO_KSYM:
+		if (att->verbose)
+			printf("Function '%s' not found in /proc/kallsyms! Skipping.\n", func_name);
+		att->func_skip_cnt++;
+		return 0;
+	case FUNC_DENIED:
+		att->deny_globs[r->glob_idx].matches++;
+		if (att->debug_extra)
+			printf("Function '%s' is denied by '%s' glob.\n",
+			       func_name, att->deny_globs[r->glob_idx].glob);
+		att->func_skip_cnt++;
+		return 0;
+	case FUNC_NOT_ALLOWED:
+		if (att->debug_extra)
+			printf("Function '%s' doesn't match any allow glob, skipping.\n", func_name);
+		att->func_skip_cnt++;
+		return 0;
+	default:
+		break;
 	}
 
-	kprobe_idx = find_kprobe(att, func_name);
-	if (kprobe_idx < 0) {
+	if (r->glob_idx >= 0) {
+		att->allow_globs[r->glob_idx].matches++;
+		if (att->debug_extra)
+			printf("Function '%s' is allowed by '%s' glob.\n",
+			       func_name, att->allow_globs[r->glob_idx].glob);
+	}
+
+	if (r->verdict == FUNC_NO_KPROBE) {
 		if (att->debug_extra)
 			printf("Function '%s' is not attachable kprobe, skipping.\n", func_name);
 		att->func_skip_cnt++;
 		return 0;
 	}
-	att->kprobes[kprobe_idx].used = true;
+	att->kprobes[r->kprobe_idx].used = true;
 
-	if (att->use_fentries && !is_func_type_ok(att->vmlinux_btf, t)) {
+	if (r->verdict == FUNC_BAD_PROTO) {
 		if (att->debug)
 			printf("Function '%s' has prototype incompatible with fentry/fexit, skipping.\n", func_name);
 		att->func_skip_cnt++;
 		return 0;
 	}
 
-	if (att->func_filter && !att->func_filter(att, att->vmlinux_btf, i, func_name, att->func_cnt)) {
+	if (att->func_filter && !att->func_filter(att, att->vmlinux_btf, btf_id, func_name, att->func_cnt)) {
 		if (att->debug)
 			printf("Function '%s' skipped due to custom filter function.\n", func_name);
 		att->func_skip_cnt++;
@@ -640,10 +739,24 @@ static int prepare_func(struct mass_attacher *att, const char *func_name,
 		return -E2BIG;
 	}
 
-	tmp = realloc(att->func_infos, (att->func_cnt + 1) * sizeof(*att->func_infos));
-	if (!tmp)
-		return -ENOMEM;
-	att->func_infos = tmp;
+	return add_func_info(att, ksym, btf_id);
+}
+
+static int add_func_info(struct mass_attacher *att, const struct ksym *ksym, int btf_id)
+{
+	struct mass_attacher_func_info *finfo;
+	int arg_cnt;
+	void *tmp;
+
+	if (att->func_cnt == att->func_info_cap) {
+		int new_cap = att->func_info_cap ? att->func_info_cap * 2 : 1024;
+
+		tmp = realloc(att->func_infos, new_cap * sizeof(*att->func_infos));
+		if (!tmp)
+			return -ENOMEM;
+		att->func_infos = tmp;
+		att->func_info_cap = new_cap;
+	}
 
 	finfo = &att->func_infos[att->func_cnt];
 	memset(finfo, 0, sizeof(*finfo));
@@ -666,37 +779,381 @@ static int prepare_func(struct mass_attacher *att, const char *func_name,
 	att->func_cnt++;
 
 	if (att->debug_extra)
-		printf("Found function '%s' at address 0x%lx...\n", func_name, ksym->addr);
+		printf("Found function '%s' at address 0x%lx...\n", ksym->name, ksym->addr);
 
 	return 0;
 }
 
-static int bump_rlimit(int resource, rlim_t max)
+static int prepare_func(struct mass_attacher *att, const char *func_name,
+			const struct btf_type *t, int btf_id)
 {
-	struct rlimit rlim_new = {
-		.rlim_cur	= max,
-		.rlim_max	= max,
-	};
+	struct func_scan_res r;
 
-	if (setrlimit(resource, &rlim_new))
+	scan_func(att, func_name, t, btf_id, &r);
+	return add_func(att, &r);
+}
+
+/* contiguous range of BTF IDs scanned by one thread */
+struct btf_scan_shard {
+	const struct mass_attacher *att;
+	int start_id;
+	int end_id;
+
+	struct func_scan_res *res;
+	int res_cnt;
+	int res_cap;
+	int err;
+
+	pthread_t thread;
+	bool started;
+};
+
+static void *scan_btf_shard(void *arg)
+{
+	struct btf_scan_shard *sh = arg;
+	const struct btf *btf = sh->att->vmlinux_btf;
+	const struct btf_type *t;
+	void *tmp;
+	int i;
+
+	for (i = sh->start_id; i < sh->end_id; i++) {
+		t = btf__type_by_id(btf, i);
+		if (!btf_is_func(t))
+			continue;
+
+		if (sh->res_cnt == sh->res_cap) {
+			int new_cap = sh->res_cap ? sh->res_cap * 2 : 1024;
+
+			tmp = realloc(sh->res, new_cap * sizeof(*sh->res));
+			if (!tmp) {
+				sh->err = -ENOMEM;
+				break;
+			}
+			sh->res = tmp;
+			sh->res_cap = new_cap;
+		}
+
+		scan_func(sh->att, btf__str_by_offset(btf, t->name_off), t, i,
+			  &sh->res[sh->res_cnt++]);
+	}
+
+	return NULL;
+}
+
+/* Check all BTF functions using multiple threads, each working on its own
+ * range of BTF IDs, then add them in BTF ID order, so that function IDs are
+ * the same as with sequential processing.
+ */
+static int prepare_btf_funcs(struct mass_attacher *att)
+{
+	struct btf_scan_shard *shards;
+	int n, thread_cnt, per_shard, i, j, err = 0;
+
+	n = btf__type_cnt(att->vmlinux_btf);
+
+	thread_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_cnt > MAX_SCAN_THREADS)
+		thread_cnt = MAX_SCAN_THREADS;
+	if (thread_cnt < 1)
+		thread_cnt = 1;
+	per_shard = (n + thread_cnt - 1) / thread_cnt;
+
+	shards = calloc(thread_cnt, sizeof(*shards));
+	if (!shards)
+		return -ENOMEM;
+
+	for (i = 0; i < thread_cnt; i++) {
+		shards[i].att = att;
+		shards[i].start_id = i == 0 ? 1 : i * per_shard;
+		shards[i].end_id = min((i + 1) * per_shard, n);
+	}
+
+	/* first shard is scanned by this thread; if thread creation fails,
+	 * shard is scanned synchronously below
+	 */
+	for (i = 1; i < thread_cnt; i++) {
+		if (pthread_create(&shards[i].thread, NULL, scan_btf_shard, &shards[i]) == 0)
+			shards[i].started = true;
+	}
+	for (i = 0; i < thread_cnt; i++) {
+		if (shards[i].started)
+			pthread_join(shards[i].thread, NULL);
+		else
+			scan_btf_shard(&shards[i]);
+	}
+
+	for (i = 0; i < thread_cnt && !err; i++) {
+		err = shards[i].err;
+		for (j = 0; j < shards[i].res_cnt && !err; j++)
+			err = add_func(att, &shards[i].res[j]);
+	}
+
+	for (i = 0; i < thread_cnt; i++)
+		free(shards[i].res);
+	free(shards);
+
+	return err;
+}
+
+/*
+ * Attach plan cache.
+ *
+ * Resolved set of functions to attach to (in function ID order) depends only
+ * on the kernel image, set of loaded modules, attach mode, and the full set of
+ * allow/deny globs, so it's cached on disk under a key built from all of them
+ * (custom func_filter is assumed to be deterministic). Cached functions are looked up in kallsyms
+ * again, so KASLR and module load addresses are always current, and any
+ * missing function or BTF mismatch invalidates the whole plan.
+ *
+ * Cache entry layout (native endianness):
+ *   u32 magic, u32 key size, key bytes;
+ *   u32 skipped function count, u32 function count;
+ *   per function: s32 BTF ID, NUL-terminated name and module ("" for vmlinux).
+ */
+#define PLAN_CACHE_MAGIC 0x4e4c5052 /* "RPLN" */
+/* bump whenever plan contents or the way plan is computed change */
+#define PLAN_CACHE_VERSION 1
+
+struct plan_buf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+static int plan_buf_add(struct plan_buf *b, const void *data, size_t len)
+{
+	size_t new_cap = b->cap ?: 4096;
+	void *tmp;
+
+	if (b->len + len > b->cap) {
+		while (new_cap < b->len + len)
+			new_cap *= 2;
+		tmp = realloc(b->data, new_cap);
+		if (!tmp)
+			return -ENOMEM;
+		b->data = tmp;
+		b->cap = new_cap;
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static int plan_buf_add_u32(struct plan_buf *b, __u32 val)
+{
+	return plan_buf_add(b, &val, sizeof(val));
+}
+
+static int plan_buf_add_str(struct plan_buf *b, const char *s)
+{
+	return plan_buf_add(b, s ?: "", s ? strlen(s) + 1 : 1);
+}
+
+static int plan_cache_key(const struct mass_attacher *att, struct plan_buf *key, char *name, size_t name_sz)
+{
+	unsigned char build_id[64];
+	__u64 hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+	char mod[256];
+	int i, n, err;
+	size_t j;
+	FILE *f;
+
+	n = kernel_build_id(build_id, sizeof(build_id));
+	if (n < 0)
+		return n;
+
+	err = plan_buf_add_u32(key, PLAN_CACHE_VERSION);
+	err = err ?: plan_buf_add_u32(key, att->use_fentries);
+	err = err ?: plan_buf_add_u32(key, att->max_func_cnt);
+	err = err ?: plan_buf_add_u32(key, n);
+	err = err ?: plan_buf_add(key, build_id, n);
+	for (i = 0; i < att->deny_glob_cnt && !err; i++) {
+		err = plan_buf_add_str(key, "deny");
+		err = err ?: plan_buf_add_str(key, att->deny_globs[i].glob);
+		err = err ?: plan_buf_add_str(key, att->deny_globs[i].mod_glob);
+	}
+	for (i = 0; i < att->allow_glob_cnt && !err; i++) {
+		err = plan_buf_add_str(key, "allow");
+		err = err ?: plan_buf_add_str(key, att->allow_globs[i].glob);
+		err = err ?: plan_buf_add_str(key, att->allow_globs[i].mod_glob);
+	}
+	if (err)
+		return err;
+
+	/* loading or unloading modules changes the set of kprobes */
+	f = fopen("/proc/modules", "r");
+	if (!f)
 		return -errno;
+	while (!err && fscanf(f, "%255s %*[^\n]\n", mod) == 1)
+		err = plan_buf_add_str(key, mod);
+	fclose(f);
+	if (err)
+		return err;
+
+	for (j = 0; j < key->len; j++) {
+		hash ^= (unsigned char)key->data[j];
+		hash *= 0x100000001b3ULL;
+	}
+	snprintf(name, name_sz, "plan-%016llx", (unsigned long long)hash);
+
+	return 0;
+}
 
+static int plan_read(const char *data, size_t sz, size_t *off, void *dst, size_t len)
+{
+	if (*off + len > sz)
+		return -EINVAL;
+	memcpy(dst, data + *off, len);
+	*off += len;
 	return 0;
 }
 
-static int kprobe_order(const void *a, const void *b)
+static const char *plan_read_str(const char *data, size_t sz, size_t *off)
 {
-	const struct kprobe_info *k1 = a, *k2 = b;
+	const char *s = data + *off, *end;
 
-	return strcmp(k1->name, k2->name);
+	if (*off >= sz)
+		return NULL;
+	end = memchr(s, '\0', sz - *off);
+	if (!end)
+		return NULL;
+	*off += end - s + 1;
+	return s;
 }
 
-static int kprobe_by_name(const void *a, const void *b)
+static int parse_cached_plan(struct mass_attacher *att, const char *data, size_t sz,
+			     const struct plan_buf *key)
 {
-	const char *name = a;
-	const struct kprobe_info *k = b;
+	const struct btf_type *t;
+	struct func_scan_res r;
+	const char *name, *mod;
+	__u32 magic, key_sz, skip_cnt, func_cnt, i;
+	size_t off = 0;
+	int btf_id, err;
+
+	err = plan_read(data, sz, &off, &magic, sizeof(magic));
+	err = err ?: plan_read(data, sz, &off, &key_sz, sizeof(key_sz));
+	if (err || magic != PLAN_CACHE_MAGIC || key_sz != key->len ||
+	    off + key_sz > sz || memcmp(data + off, key->data, key_sz) != 0)
+		return -ESTALE;
+	off += key_sz;
+
+	err = plan_read(data, sz, &off, &skip_cnt, sizeof(skip_cnt));
+	err = err ?: plan_read(data, sz, &off, &func_cnt, sizeof(func_cnt));
+	if (err)
+		return err;
+
+	for (i = 0; i < func_cnt; i++) {
+		err = plan_read(data, sz, &off, &btf_id, sizeof(btf_id));
+		if (err)
+			return err;
+		name = plan_read_str(data, sz, &off);
+		mod = plan_read_str(data, sz, &off);
+		if (!name || !mod)
+			return -EINVAL;
+
+		t = NULL;
+		if (btf_id) {
+			t = btf__type_by_id(att->vmlinux_btf, btf_id);
+			if (!t || !btf_is_func(t) ||
+			    strcmp(btf__str_by_offset(att->vmlinux_btf, t->name_off), name) != 0)
+				return -ESTALE;
+		} else if (att->use_fentries) {
+			return -ESTALE;
+		}
+
+		/* cache file is not trusted, so re-run all the same checks
+		 * (deny/allow globs, kprobe availability, prototype) that
+		 * full scan does
+		 */
+		scan_func(att, name, t, btf_id, &r);
+		if (r.verdict != FUNC_OK || strcmp(r.ksym->module ?: "", mod) != 0)
+			return -ESTALE;
 
-	return strcmp(name, k->name);
+		err = add_func_info(att, r.ksym, btf_id);
+		if (err)
+			return err;
+	}
+
+	att->func_skip_cnt = skip_cnt;
+	return 0;
+}
+
+static int load_cached_plan(struct mass_attacher *att)
+{
+	struct plan_buf key = {};
+	char name[64];
+	void *data = NULL;
+	size_t sz;
+	int err;
+
+	err = plan_cache_key(att, &key, name, sizeof(name));
+	if (err)
+		goto cleanup;
+
+	err = cache__read(name, &data, &sz);
+	if (err)
+		goto cleanup;
+
+	err = parse_cached_plan(att, data, sz, &key);
+	if (err) {
+		/* start from scratch */
+		att->func_cnt = 0;
+		memset(att->func_info_cnts, 0, sizeof(att->func_info_cnts));
+		memset(att->func_info_id_for_arg_cnt, 0, sizeof(att->func_info_id_for_arg_cnt));
+		if (att->verbose)
+			printf("Ignoring invalid cached attach plan '%s': %d\n", name, err);
+		goto cleanup;
+	}
+
+	if (att->verbose)
+		printf("Using cached attach plan '%s' with %d functions.\n", name, att->func_cnt);
+
+cleanup:
+	free(data);
+	free(key.data);
+	return err;
+}
+
+static void save_cached_plan(struct mass_attacher *att)
+{
+	const struct mass_attacher_func_info *finfo;
+	struct plan_buf key = {}, buf = {};
+	char name[64];
+	int i, err;
+
+	err = plan_cache_key(att, &key, name, sizeof(name));
+	err = err ?: plan_buf_add_u32(&buf, PLAN_CACHE_MAGIC);
+	err = err ?: plan_buf_add_u32(&buf, key.len);
+	err = err ?: plan_buf_add(&buf, key.data, key.len);
+	err = err ?: plan_buf_add_u32(&buf, att->func_skip_cnt);
+	err = err ?: plan_buf_add_u32(&buf, att->func_cnt);
+	for (i = 0; i < att->func_cnt && !err; i++) {
+		finfo = &att->func_infos[i];
+		err = plan_buf_add(&buf, &finfo->btf_id, sizeof(finfo->btf_id));
+		err = err ?: plan_buf_add_str(&buf, finfo->name);
+		err = err ?: plan_buf_add_str(&buf, finfo->module);
+	}
+	err = err ?: cache__write(name, buf.data, buf.len);
+	if (err && att->verbose)
+		fprintf(stderr, "Failed to cache attach plan, ignoring: %d\n", err);
+
+	free(key.data);
+	free(buf.data);
+}
+
+static int bump_rlimit(int resource, rlim_t max)
+{
+	struct rlimit rlim_new = {
+		.rlim_cur	= max,
+		.rlim_max	= max,
+	};
+
+	if (setrlimit(resource, &rlim_new))
+		return -errno;
+
+	return 0;
 }
 
 #define str_has_pfx(str, pfx) \
@@ -720,45 +1177,122 @@ static const char *tracefs_available_filter_functions(void)
 	return use_debugfs() ? DEBUGFS"/available_filter_functions" : TRACEFS"/available_filter_functions";
 }
 
+#define KPROBE_BLACKLIST "/sys/kernel/debug/kprobes/blacklist"
+
+/* Functions in kprobe blacklist are listed as available for ftrace, but
+ * kprobes can't be attached to them, so exclude them upfront instead of
+ * failing the attachment. Blacklist is only exposed through debugfs, so
+ * this is a best-effort check.
+ */
+static void load_kprobe_blacklist(struct mass_attacher *att)
+{
+	const struct ksym *ksym;
+	char *buf, *s, *name, *next;
+	int id, cnt = 0;
+	size_t sz;
+
+	if (read_file(KPROBE_BLACKLIST, &buf, &sz)) {
+		if (att->debug)
+			printf("Kprobe blacklist is not available, skipping.\n");
+		return;
+	}
+
+	/* each line is "0x<start>-0x<end>\t<name>", optionally followed by
+	 * " [<module>]"
+	 */
+	for (s = buf; *s; s = next) {
+		next = s + strcspn(s, "\n");
+		if (*next)
+			*next++ = '\0';
+
+		s += strcspn(s, " \t");
+		s += strspn(s, " \t");
+		name = s;
+		s += strcspn(s, " \t");
+		*s = '\0';
+
+		ksym = name[0] ? ksyms__get_symbol(att->ksyms, name) : NULL;
+		if (!ksym)
+			continue;
+
+		id = ksyms__sym_id(att->ksyms, ksym);
+		if (att->sym_kprobes[id] >= 0) {
+			att->sym_kprobes[id] = -1;
+			cnt++;
+		}
+	}
+	free(buf);
+
+	if (att->verbose)
+		printf("Excluded %d blacklisted kprobes.\n", cnt);
+}
+
 static int load_available_kprobes(struct mass_attacher *att)
 {
-	static char buf[512];
 	const char *fname = tracefs_available_filter_functions();
-	int cnt, err;
-	void *tmp, *s;
-	FILE *f;
+	const struct ksym *ksym;
+	char *s, *name, *next;
+	int err, id, cap = 0;
+	size_t sz;
+	void *tmp;
 
-	f = fopen(fname, "r");
-	if (!f) {
-		err = -errno;
-		fprintf(stderr, "Failed to open %s: %d\n", fname, err);
+	att->sym_kprobes = malloc(ksyms__sym_cnt(att->ksyms) * sizeof(*att->sym_kprobes));
+	if (!att->sym_kprobes)
+		return -ENOMEM;
+	memset(att->sym_kprobes, 0xff, ksyms__sym_cnt(att->ksyms) * sizeof(*att->sym_kprobes));
+
+	err = read_file(fname, &att->kprobe_strs, &sz);
+	if (err) {
+		fprintf(stderr, "Failed to read %s: %d\n", fname, err);
 		return err;
 	}
 
-	while ((cnt = fscanf(f, "%s%*[^\n]\n", buf)) == 1) {
+	/* each line is "<name>" or "<name> [<module>]", function names are
+	 * terminated in place and used directly from the file buffer
+	 */
+	for (s = att->kprobe_strs; *s; s = next) {
+		next = s + strcspn(s, "\n");
+		if (*next)
+			*next++ = '\0';
+
+		name = s;
+		s += strcspn(s, " \t");
+		*s = '\0';
+
 		/* ignore explicitly fake/invalid kprobe entries */
-		if (str_has_pfx(buf, "__ftrace_invalid_address___"))
+		if (name[0] == '\0' || str_has_pfx(name, "__ftrace_invalid_address___"))
 			continue;
 
-		tmp = realloc(att->kprobes, (att->kprobe_cnt + 1) * sizeof(*att->kprobes));
-		if (!tmp)
-			return -ENOMEM;
-		att->kprobes = tmp;
+		ksym = ksyms__get_symbol(att->ksyms, name);
+		if (ksym) {
+			id = ksyms__sym_id(att->ksyms, ksym);
+			/* static functions with the same name are
+			 * indistinguishable by name, keep just one entry
+			 */
+			if (att->sym_kprobes[id] >= 0)
+				continue;
+			att->sym_kprobes[id] = att->kprobe_cnt;
+		}
+
+		if (att->kprobe_cnt == cap) {
+			cap = cap ? cap * 2 : 64 * 1024;
+			tmp = realloc(att->kprobes, cap * sizeof(*att->kprobes));
+			if (!tmp)
+				return -ENOMEM;
+			att->kprobes = tmp;
+		}
 
-		s = strdup(buf);
-		att->kprobes[att->kprobe_cnt].name = s;
+		att->kprobes[att->kprobe_cnt].name = name;
 		att->kprobes[att->kprobe_cnt].used = false;
 		att->kprobe_cnt++;
-
-		if (!s)
-			return -ENOMEM;
 	}
 
-	qsort(att->kprobes, att->kprobe_cnt, sizeof(*att->kprobes), kprobe_order);
-
 	if (att->verbose)
 		printf("Discovered %d available kprobes!\n", att->kprobe_cnt);
 
+	if (!att->use_fentries)
+		load_kprobe_blacklist(att);
+
 	return 0;
 }
 
@@ -768,6 +1302,7 @@ static bool is_ret_void(const struct btf *btf, int btf_id);
 int mass_attacher__load(struct mass_attacher *att)
 {
 	int err = 0, i, map_fd;
+	uint64_t ts;
 
 	/* we can't pass extra context to hijack_progs, so we set thread-local
 	 * cur_attacher variable temporarily for the duration of skeleton's
@@ -775,8 +1310,10 @@ int mass_attacher__load(struct mass_attacher *att)
 	 */
 	cur_attacher = att;
 	/* Load & verify BPF programs */
+	ts = startup_prof__ts();
 	if (!att->dry_run)
 		err = SKEL_LOAD(att->skel);
+	startup_prof__phase("skel_load", ts);
 	cur_attacher = NULL;
 
 	if (err) {
@@ -802,7 +1339,9 @@ int mass_attacher__load(struct mass_attacher *att)
 		 */
 		if (att->use_fentries || !att->has_bpf_cookie) {
 			map_fd = bpf_map__fd(att->skel->maps.ip_to_id);
+			ts = startup_prof__ts();
 			err = bpf_map_update_elem(map_fd, &func_addr, &i, 0);
+			startup_prof__item("ip_to_id_update", ts);
 			if (err) {
 				err = -errno;
 				fprintf(stderr, "Failed to add 0x%lx -> '%s' lookup entry to BPF map: %d\n",
@@ -812,17 +1351,21 @@ int mass_attacher__load(struct mass_attacher *att)
 		}
 
 		if (att->use_fentries) {
+			ts = startup_prof__ts();
 			err = clone_prog(att->fentries[finfo->arg_cnt], finfo->btf_id);
+			startup_prof__item("prog_clone", ts);
 			if (err < 0) {
 				fprintf(stderr, "Failed to clone FENTRY BPF program for function '%s': %d\n", func_name, err);
 				return err;
 			}
 			finfo->fentry_prog_fd = err;
 
+			ts = startup_prof__ts();
 			if (is_ret_void(att->vmlinux_btf, finfo->btf_id))
 				err = clone_prog(att->fexit_voids[finfo->arg_cnt], finfo->btf_id);
 			else
 				err = clone_prog(att->fexits[finfo->arg_cnt], finfo->btf_id);
+			startup_prof__item("prog_clone", ts);
 			if (err < 0) {
 				fprintf(stderr, "Failed to clone FEXIT BPF program for function '%s': %d\n", func_name, err);
 				return err;
@@ -859,6 +1402,7 @@ int mass_attacher__attach(struct mass_attacher *att)
 	unsigned long *addrs = NULL;
 	const char **syms = NULL;
 	__u64 *cookies = NULL;
+	uint64_t ts;
 	int i, err;
 
 	if (att->use_kprobe_multi) {
@@ -888,6 +1432,7 @@ int mass_attacher__attach(struct mass_attacher *att)
 		if (att->use_fentries) {
 			int prog_fd;
 
+			ts = startup_prof__ts();
 			prog_fd = att->func_infos[i].fentry_prog_fd;
 			err = bpf_raw_tracepoint_open(NULL, prog_fd);
 			if (err < 0) {
@@ -905,6 +1450,7 @@ int mass_attacher__attach(struct mass_attacher *att)
 				goto err_out;
 			}
 			att->func_infos[i].fexit_link_fd = err;
+			startup_prof__item("attach", ts);
 		} else {
 			if (att->use_kprobe_multi) {
 				addrs[i] = func_addr;
@@ -913,6 +1459,7 @@ int mass_attacher__attach(struct mass_attacher *att)
 				goto skip_attach;
 			}
 
+			ts = startup_prof__ts();
 			kprobe_opts.retprobe = false;
 			if (att->has_bpf_cookie)
 				kprobe_opts.bpf_cookie = i;
@@ -936,6 +1483,7 @@ int mass_attacher__attach(struct mass_attacher *att)
 					i + 1, func_desc, func_addr, err);
 				goto err_out;
 			}
+			startup_prof__item("attach", ts);
 		}
 
 skip_attach:
@@ -966,6 +1514,7 @@ skip_attach:
 		 * attachment, which is still much faster than one-by-one
 		 * kprobe.
 		 */
+		ts = startup_prof__ts();
 		multi_opts.retprobe = false;
 		multi_link = bpf_program__attach_kprobe_multi_opts(att->skel->progs.kentry,
 								   NULL, &multi_opts);
@@ -993,6 +1542,7 @@ skip_attach:
 			goto err_out;
 		}
 		att->kexit_multi_link = multi_link;
+		startup_prof__phase("attach_multi", ts);
 	}
 
 	if (att->verbose) {
@@ -1038,13 +1588,9 @@ const struct mass_attacher_func_info *mass_attacher__func(const struct mass_atta
 	return &att->func_infos[id];
 }
 
-static int find_kprobe(const struct mass_attacher *att, const char *name)
+static int find_kprobe(const struct mass_attacher *att, const struct ksym *ksym)
 {
-	struct kprobe_info *k;
-
-	k = bsearch(name, att->kprobes, att->kprobe_cnt, sizeof(*att->kprobes), kprobe_by_name);
-
-	return k == NULL ? -1 : k - att->kprobes;
+	return att->sym_kprobes[ksyms__sym_id(att->ksyms, ksym)];
 }
 
 static int func_arg_cnt(const struct btf *btf, int id)
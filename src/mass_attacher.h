@@ -47,6 +47,10 @@ struct mass_attacher_opts {
 	bool debug;
 	bool debug_extra;
 	bool dry_run;
+	/* reuse function selection results of previous runs, see
+	 * load_cached_plan() in mass_attacher.c
+	 */
+	bool plan_cache;
 	func_filter_fn func_filter;
 };
 
@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "output.h"
+#include "utils.h"
+
+#define OUTPUT_BUF_SZ (1024 * 1024)
+/* in block-buffered mode, write out at the end of a record once this much
+ * output has accumulated
+ */
+#define OUTPUT_FLUSH_SZ (64 * 1024)
+
+static struct output {
+	int fd;
+	int err;
+	bool line_buffered;
+	bool threaded;
+
+	/* buffer being filled by output__printf() */
+	char *buf;
+	size_t len;
+	size_t cap;
+
+	/* writer thread state; wbuf is owned by writer thread while wlen > 0 */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *wbuf;
+	size_t wlen;
+	size_t wcap;
+	bool stop;
+} out = {
+	.fd = STDOUT_FILENO,
+	.line_buffered = true,
+};
+
+static void write_all(const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(out.fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			/* remember the first error, drop the rest of output */
+			if (!out.err)
+				out.err = -errno;
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void *writer_thread(void *arg)
+{
+	pthread_mutex_lock(&out.lock);
+	while (true) {
+		while (!out.wlen && !out.stop)
+			pthread_cond_wait(&out.cond, &out.lock);
+		if (!out.wlen)
+			break;
+
+		pthread_mutex_unlock(&out.lock);
+		write_all(out.wbuf, out.wlen);
+		pthread_mutex_lock(&out.lock);
+
+		out.wlen = 0;
+		pthread_cond_broadcast(&out.cond);
+	}
+	pthread_mutex_unlock(&out.lock);
+
+	return NULL;
+}
+
+static void wait_writer(void)
+{
+	pthread_mutex_lock(&out.lock);
+	while (out.wlen)
+		pthread_cond_wait(&out.cond, &out.lock);
+	pthread_mutex_unlock(&out.lock);
+}
+
+static void submit(void)
+{
+	char *tmp;
+	size_t tmp_cap;
+
+	if (!out.len)
+		return;
+
+	if (!out.threaded) {
+		write_all(out.buf, out.len);
+		out.len = 0;
+		return;
+	}
+
+	/* hand over filled buffer to writer thread and continue with the
+	 * buffer it wrote out previously
+	 */
+	pthread_mutex_lock(&out.lock);
+	while (out.wlen)
+		pthread_cond_wait(&out.cond, &out.lock);
+
+	tmp = out.wbuf;
+	tmp_cap = out.wcap;
+	out.wbuf = out.buf;
+	out.wcap = out.cap;
+	out.wlen = out.len;
+	out.buf = tmp;
+	out.cap = tmp_cap;
+	out.len = 0;
+
+	pthread_cond_broadcast(&out.cond);
+	pthread_mutex_unlock(&out.lock);
+}
+
+int output__init(bool use_thread)
+{
+	int err;
+
+	out.line_buffered = isatty(out.fd);
+
+	if (!use_thread)
+		return 0;
+
+	pthread_mutex_init(&out.lock, NULL);
+	pthread_cond_init(&out.cond, NULL);
+
+	err = pthread_create(&out.thread, NULL, writer_thread, NULL);
+	if (err) {
+		fprintf(stderr, "Failed to create output writer thread: %d\n", -err);
+		pthread_cond_destroy(&out.cond);
+		pthread_mutex_destroy(&out.lock);
+		return -err;
+	}
+	out.threaded = true;
+
+	return 0;
+}
+
+int output__take_stdout(void)
+{
+	int fd, err;
+
+	fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+	if (fd < 0)
+		return -errno;
+
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	out.fd = fd;
+	return 0;
+}
+
+int output__fini(void)
+{
+	output__flush(true);
+
+	if (out.threaded) {
+		pthread_mutex_lock(&out.lock);
+		out.stop = true;
+		pthread_cond_broadcast(&out.cond);
+		pthread_mutex_unlock(&out.lock);
+
+		pthread_join(out.thread, NULL);
+		pthread_cond_destroy(&out.cond);
+		pthread_mutex_destroy(&out.lock);
+		out.threaded = false;
+	}
+
+	free(out.buf);
+	free(out.wbuf);
+	out.buf = out.wbuf = NULL;
+	out.len = out.cap = out.wlen = out.wcap = 0;
+
+	if (out.fd != STDOUT_FILENO) {
+		if (close(out.fd) && !out.err)
+			out.err = -errno;
+		out.fd = STDOUT_FILENO;
+	}
+
+	return out.err;
+}
+
+static int reserve(size_t len)
+{
+	size_t new_cap = out.cap;
+	void *tmp;
+
+	if (out.len + len < out.cap)
+		return 0;
+
+	while (new_cap <= out.len + len)
+		new_cap = new_cap ? new_cap * 2 : OUTPUT_BUF_SZ;
+
+	tmp = realloc(out.buf, new_cap);
+	if (!tmp)
+		return -ENOMEM;
+
+	out.buf = tmp;
+	out.cap = new_cap;
+	return 0;
+}
+
+void output__printf(const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vsnprintf(out.buf + out.len, out.cap - out.len, fmt, args);
+	va_end(args);
+	if (n < 0)
+		return;
+
+	if (out.len + n >= out.cap) {
+		if (reserve(n)) {
+			if (!out.err)
+				out.err = -ENOMEM;
+			return;
+		}
+		va_start(args, fmt);
+		vsnprintf(out.buf + out.len, out.cap - out.len, fmt, args);
+		va_end(args);
+	}
+	out.len += n;
+
+	if (out.line_buffered && n > 0 && out.buf[out.len - 1] == '\n')
+		submit();
+}
+
+static void json_emit(void *ctx, const char *s, size_t len)
+{
+	output__printf("%.*s", (int)len, s);
+}
+
+void output__json_str(const char *str)
+{
+	json_emit_str(str, json_emit, NULL);
+}
+
+void output__end_record(void)
+{
+	if (out.len >= OUTPUT_FLUSH_SZ)
+		submit();
+}
+
+void output__flush(bool wait)
+{
+	submit();
+
+	if (wait && out.threaded)
+		wait_writer();
+}
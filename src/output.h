@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <stdbool.h>
+
+/*
+ * Buffered writer for stack/trace output going to stdout.
+ *
+ * Output is accumulated in a large buffer and written out only at record
+ * (stack) boundaries, so consumers never see partially emitted stacks.
+ * If stdout is a TTY, output is line-buffered instead, as with stdio.
+ * Optionally, writing can be offloaded to a dedicated writer thread, so
+ * that slow files or pipes don't stall event processing.
+ */
+int output__init(bool use_thread);
+int output__fini(void);
+
+/* keep original stdout exclusively for output and point stdout (so printf()
+ * and the like) to stderr, so that machine-readable output isn't mixed with
+ * status messages; has to be called before anything is printed
+ */
+int output__take_stdout(void);
+
+__attribute__((format(printf, 1, 2)))
+void output__printf(const char *fmt, ...);
+
+/* emit string as a quoted and escaped JSON string */
+void output__json_str(const char *str);
+
+/* mark the end of a logical record (e.g., a single stack) */
+void output__end_record(void);
+/* write out all the buffered output; with wait == true, also wait for the
+ * writer thread (if any) to complete writing it
+ */
+void output__flush(bool wait);
+
+#endif /* __OUTPUT_H */
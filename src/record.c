@@ -0,0 +1,781 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <linux/perf_event.h>
+#include "retsnoop.h"
+#include "record.h"
+#include "hashmap.h"
+#include "utils.h"
+
+#define RECORD_BUF_SZ (4 * 1024 * 1024)
+
+/* no BPF record comes anywhere close, anything bigger is a corruption */
+#define RECORD_RAW_MAX_SZ (1024 * 1024)
+
+/* max size of encoded function trace record */
+#define FT_ENC_MAX_SZ (1 + 10 * 10 + sizeof(struct flow_tuple))
+
+/* per-task state of function trace delta encoding */
+struct ft_state {
+	long ts;
+	int seq_id;
+	int depth;
+};
+
+/* dictionary of flow tuples, keys in flow_dict.idx are indices into flows */
+struct flow_dict {
+	struct hashmap *idx;
+	struct flow_tuple *flows;
+	int cnt;
+	int cap;
+};
+
+struct recorder {
+	FILE *f;
+	char *buf;
+	int func_cnt;
+	int func_added;
+	size_t rec_cnt;
+	size_t byte_cnt;
+
+	struct hashmap *ft_states;
+	struct flow_dict flows;
+};
+
+static inline __u64 zigzag(long v)
+{
+	return ((__u64)v << 1) ^ (__u64)(v >> 63);
+}
+
+static inline long unzigzag(__u64 v)
+{
+	return (long)(v >> 1) ^ -(long)(v & 1);
+}
+
+static size_t put_varint(__u8 *buf, __u64 v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+
+	return n;
+}
+
+static size_t pid_hasher(const void *key, void *ctx)
+{
+	return (size_t)key;
+}
+
+static bool pid_equal(const void *key1, const void *key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+static struct ft_state *ft_state_get(struct hashmap *states, int pid)
+{
+	const void *k = (const void *)(uintptr_t)pid;
+	struct ft_state *st;
+
+	if (hashmap__find(states, k, (void **)&st))
+		return st;
+
+	st = calloc(1, sizeof(*st));
+	if (!st || hashmap__add(states, k, st)) {
+		free(st);
+		return NULL;
+	}
+	return st;
+}
+
+static void ft_state_reset(struct hashmap *states, int pid)
+{
+	void *st;
+
+	if (hashmap__delete(states, (const void *)(uintptr_t)pid, NULL, &st))
+		free(st);
+}
+
+/* Forget task's state once its trace completes, so that it doesn't pile up
+ * with PID churn. Both recorder and replayer do that at the same record, so
+ * the next trace of the task is just encoded relative to zero state. The
+ * outermost exit can be lost, so state is reset at the start of the task's
+ * next trace as well, see ft_state_start().
+ */
+static void ft_state_put(struct hashmap *states, const struct func_trace_entry *fe)
+{
+	if (fe->type == REC_FUNC_TRACE_EXIT && fe->depth == 1)
+		ft_state_reset(states, fe->pid);
+}
+
+static void ft_state_start(struct hashmap *states, const void *data, size_t sz)
+{
+	const struct func_trace_start *r = data;
+
+	if (sz == sizeof(*r) && r->type == REC_FUNC_TRACE_START)
+		ft_state_reset(states, r->pid);
+}
+
+static void ft_states_free(struct hashmap *states)
+{
+	struct hashmap_entry *e;
+	size_t bkt;
+
+	if (!states)
+		return;
+
+	hashmap__for_each_entry(states, e, bkt)
+		free(e->value);
+	hashmap__free(states);
+}
+
+static size_t flow_hasher(const void *key, void *ctx)
+{
+	const struct flow_dict *d = ctx;
+	const struct flow_tuple *f = &d->flows[(uintptr_t)key];
+
+	return (f->saddr * 31 + f->daddr) * 31 + ((__u32)f->sport << 16 | f->dport);
+}
+
+static bool flow_equal(const void *key1, const void *key2, void *ctx)
+{
+	const struct flow_dict *d = ctx;
+	const struct flow_tuple *f1 = &d->flows[(uintptr_t)key1];
+	const struct flow_tuple *f2 = &d->flows[(uintptr_t)key2];
+
+	return f1->saddr == f2->saddr && f1->daddr == f2->daddr &&
+	       f1->sport == f2->sport && f1->dport == f2->dport;
+}
+
+/* Make sure there is space for one more flow tuple in dictionary */
+static int flow_dict_reserve(struct flow_dict *d)
+{
+	struct flow_tuple *tmp;
+	int new_cap;
+
+	if (d->cnt < d->cap)
+		return 0;
+
+	new_cap = d->cap ? d->cap * 2 : 256;
+	tmp = realloc(d->flows, new_cap * sizeof(*d->flows));
+	if (!tmp)
+		return -ENOMEM;
+	d->flows = tmp;
+	d->cap = new_cap;
+	return 0;
+}
+
+/* Returns index of a given flow tuple in dictionary, if it's there already.
+ * Otherwise adds it to dictionary and returns -ENOENT.
+ */
+static int flow_dict_find_or_add(struct flow_dict *d, const struct flow_tuple *f)
+{
+	const void *k = (const void *)(uintptr_t)d->cnt;
+	void *idx;
+	int err;
+
+	err = flow_dict_reserve(d);
+	if (err)
+		return err;
+
+	/* use next free slot as lookup key */
+	d->flows[d->cnt] = *f;
+	if (hashmap__find(d->idx, k, &idx))
+		return (uintptr_t)idx;
+
+	err = hashmap__add(d->idx, k, (void *)k);
+	if (err)
+		return err;
+	d->cnt++;
+	return -ENOENT;
+}
+
+static void flow_dict_free(struct flow_dict *d)
+{
+	hashmap__free(d->idx);
+	free(d->flows);
+}
+
+/* /proc/kallsyms doesn't report its size, so just keep growing the buffer */
+static char *read_kallsyms(size_t *sz)
+{
+	size_t cap = 0, len = 0, n;
+	char *buf = NULL, *tmp;
+	FILE *f;
+
+	f = fopen("/proc/kallsyms", "r");
+	if (!f)
+		return NULL;
+
+	while (true) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 4 * 1024 * 1024;
+			tmp = realloc(buf, cap);
+			if (!tmp)
+				goto err_out;
+			buf = tmp;
+		}
+		n = fread(buf + len, 1, cap - len, f);
+		len += n;
+		if (n == 0) {
+			if (ferror(f))
+				goto err_out;
+			break;
+		}
+	}
+	fclose(f);
+
+	*sz = len;
+	return buf;
+
+err_out:
+	free(buf);
+	fclose(f);
+	return NULL;
+}
+
+static int recorder__emit(struct recorder *r, const void *data, size_t data_sz)
+{
+	if (data_sz && fwrite(data, data_sz, 1, r->f) != 1)
+		return -errno ?: -EIO;
+	r->byte_cnt += data_sz;
+	return 0;
+}
+
+struct recorder *recorder__new(const char *path, __u64 ktime_off, int func_cnt)
+{
+	struct record_hdr hdr = {};
+	struct recorder *r;
+	char *ksyms = NULL;
+	size_t ksyms_sz;
+	int err;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->func_cnt = func_cnt;
+	r->buf = malloc(RECORD_BUF_SZ);
+	r->ft_states = hashmap__new(pid_hasher, pid_equal, NULL);
+	r->flows.idx = hashmap__new(flow_hasher, flow_equal, &r->flows);
+	if (!r->buf || !r->ft_states || !r->flows.idx)
+		goto err_out;
+
+	r->f = fopen(path, "w");
+	if (!r->f) {
+		err = -errno;
+		fprintf(stderr, "Failed to create recording file '%s': %d\n", path, err);
+		goto err_out;
+	}
+	/* online cost of recording should be a memcpy, so buffer a lot */
+	setvbuf(r->f, r->buf, _IOFBF, RECORD_BUF_SZ);
+
+	ksyms = read_kallsyms(&ksyms_sz);
+	if (!ksyms) {
+		fprintf(stderr, "Failed to snapshot /proc/kallsyms for recording\n");
+		goto err_out;
+	}
+
+	hdr.magic = RECORD_MAGIC;
+	hdr.version = RECORD_VERSION;
+	hdr.hdr_sz = sizeof(hdr);
+	hdr.func_cnt = func_cnt;
+	hdr.ktime_off = ktime_off;
+	hdr.kallsyms_sz = ksyms_sz;
+
+	err = kernel_build_id(hdr.build_id, sizeof(hdr.build_id));
+	if (err < 0)
+		fprintf(stderr, "Failed to determine kernel build ID, ignoring: %d\n", err);
+	else
+		hdr.build_id_sz = err;
+
+	err = recorder__emit(r, &hdr, sizeof(hdr));
+	err = err ?: recorder__emit(r, ksyms, ksyms_sz);
+	if (err) {
+		fprintf(stderr, "Failed to write recording header to '%s': %d\n", path, err);
+		goto err_out;
+	}
+
+	free(ksyms);
+	return r;
+
+err_out:
+	free(ksyms);
+	recorder__free(r);
+	return NULL;
+}
+
+void recorder__free(struct recorder *r)
+{
+	if (!r)
+		return;
+
+	if (r->f)
+		fclose(r->f);
+	ft_states_free(r->ft_states);
+	flow_dict_free(&r->flows);
+	free(r->buf);
+	free(r);
+}
+
+int recorder__add_func(struct recorder *r, const char *name, const char *module,
+		       long addr, long size, int flags)
+{
+	struct record_func rf = {};
+	int err;
+
+	if (r->func_added >= r->func_cnt)
+		return -E2BIG;
+
+	rf.addr = addr;
+	rf.size = size;
+	rf.flags = flags;
+	rf.name_len = strlen(name);
+	rf.mod_len = module ? strlen(module) : 0;
+
+	err = recorder__emit(r, &rf, sizeof(rf));
+	err = err ?: recorder__emit(r, name, rf.name_len);
+	err = err ?: recorder__emit(r, module, rf.mod_len);
+	if (err)
+		return err;
+
+	r->func_added++;
+	return 0;
+}
+
+static int recorder__encode_ft(struct recorder *r, const struct func_trace_entry *fe,
+			       __u8 *buf, size_t *sz)
+{
+	struct ft_state *st;
+	size_t n = 0;
+	int idx;
+
+	st = ft_state_get(r->ft_states, fe->pid);
+	if (!st)
+		return -ENOMEM;
+
+	idx = flow_dict_find_or_add(&r->flows, &fe->flow_info);
+	if (idx < 0 && idx != -ENOENT)
+		return idx;
+
+	buf[n++] = fe->type == REC_FUNC_TRACE_ENTRY ? REC_TAG_FT_ENTRY : REC_TAG_FT_EXIT;
+	n += put_varint(buf + n, fe->pid);
+	n += put_varint(buf + n, zigzag(fe->ts - st->ts));
+	n += put_varint(buf + n, zigzag(fe->seq_id - st->seq_id));
+	n += put_varint(buf + n, zigzag(fe->depth - st->depth));
+	n += put_varint(buf + n, fe->func_id);
+	if (fe->type == REC_FUNC_TRACE_EXIT) {
+		n += put_varint(buf + n, zigzag(fe->func_lat));
+		n += put_varint(buf + n, zigzag(fe->func_res));
+		n += put_varint(buf + n, zigzag(fe->func_self_lat));
+		n += put_varint(buf + n, zigzag(fe->func_offcpu_lat));
+	}
+	if (idx == -ENOENT) {
+		buf[n++] = 0;
+		memcpy(buf + n, &fe->flow_info.saddr, 4);
+		memcpy(buf + n + 4, &fe->flow_info.daddr, 4);
+		memcpy(buf + n + 8, &fe->flow_info.sport, 2);
+		memcpy(buf + n + 10, &fe->flow_info.dport, 2);
+		n += 12;
+	} else {
+		n += put_varint(buf + n, idx + 1);
+	}
+
+	st->ts = fe->ts;
+	st->seq_id = fe->seq_id;
+	st->depth = fe->depth;
+	ft_state_put(r->ft_states, fe);
+
+	*sz = n;
+	return 0;
+}
+
+int recorder__write(struct recorder *r, const void *data, size_t data_sz)
+{
+	enum rec_type type = *(const enum rec_type *)data;
+	__u8 buf[FT_ENC_MAX_SZ];
+	size_t sz;
+	int err;
+
+	if (r->func_added != r->func_cnt)
+		return -EINVAL;
+
+	if ((type == REC_FUNC_TRACE_ENTRY || type == REC_FUNC_TRACE_EXIT) &&
+	    data_sz >= sizeof(struct func_trace_entry)) {
+		err = recorder__encode_ft(r, data, buf, &sz);
+		err = err ?: recorder__emit(r, buf, sz);
+	} else {
+		buf[0] = REC_TAG_RAW;
+		sz = 1 + put_varint(buf + 1, data_sz);
+		err = recorder__emit(r, buf, sz);
+		err = err ?: recorder__emit(r, data, data_sz);
+		ft_state_start(r->ft_states, data, data_sz);
+	}
+	if (err) {
+		fprintf(stderr, "Failed to write record #%zu: %d\n", r->rec_cnt, err);
+		return err;
+	}
+
+	r->rec_cnt++;
+	return 0;
+}
+
+size_t recorder__record_cnt(const struct recorder *r)
+{
+	return r->rec_cnt;
+}
+
+size_t recorder__byte_cnt(const struct recorder *r)
+{
+	return r->byte_cnt;
+}
+
+struct replayer {
+	FILE *f;
+	char *buf;
+	struct record_hdr hdr;
+	char *kallsyms;
+	struct replay_func *funcs;
+	void *rec;
+	size_t rec_cap;
+
+	struct hashmap *ft_states;
+	struct flow_dict flows;
+};
+
+static int replayer__read(struct replayer *r, void *data, size_t data_sz)
+{
+	if (data_sz && fread(data, data_sz, 1, r->f) != 1)
+		return ferror(r->f) ? -EIO : -ENODATA;
+	return 0;
+}
+
+static int replayer__read_varint(struct replayer *r, __u64 *val)
+{
+	__u64 v = 0;
+	int shift = 0, c;
+
+	do {
+		c = getc_unlocked(r->f);
+		if (c == EOF)
+			return ferror(r->f) ? -EIO : -ENODATA;
+		if (shift > 63)
+			return -EINVAL;
+		v |= (__u64)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*val = v;
+	return 0;
+}
+
+static char *replayer__read_str(struct replayer *r, size_t len)
+{
+	char *str;
+
+	str = malloc(len + 1);
+	if (!str)
+		return NULL;
+	if (replayer__read(r, str, len)) {
+		free(str);
+		return NULL;
+	}
+	str[len] = '\0';
+
+	return str;
+}
+
+struct replayer *replayer__open(const char *path)
+{
+	struct record_func rf;
+	struct replayer *r;
+	int i, err;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->buf = malloc(RECORD_BUF_SZ);
+	r->ft_states = hashmap__new(pid_hasher, pid_equal, NULL);
+	if (!r->buf || !r->ft_states)
+		goto err_out;
+
+	r->f = fopen(path, "r");
+	if (!r->f) {
+		err = -errno;
+		fprintf(stderr, "Failed to open recording file '%s': %d\n", path, err);
+		goto err_out;
+	}
+	setvbuf(r->f, r->buf, _IOFBF, RECORD_BUF_SZ);
+
+	err = replayer__read(r, &r->hdr, sizeof(r->hdr));
+	if (err || r->hdr.magic != RECORD_MAGIC) {
+		fprintf(stderr, "'%s' is not a retsnoop recording\n", path);
+		goto err_out;
+	}
+	if (r->hdr.version != RECORD_VERSION || r->hdr.hdr_sz != sizeof(r->hdr)) {
+		fprintf(stderr, "Unsupported recording format version %u\n", r->hdr.version);
+		goto err_out;
+	}
+
+	r->kallsyms = malloc(r->hdr.kallsyms_sz);
+	if (!r->kallsyms || replayer__read(r, r->kallsyms, r->hdr.kallsyms_sz)) {
+		fprintf(stderr, "Failed to read kallsyms snapshot from '%s'\n", path);
+		goto err_out;
+	}
+
+	r->funcs = calloc(r->hdr.func_cnt, sizeof(*r->funcs));
+	if (!r->funcs && r->hdr.func_cnt)
+		goto err_out;
+
+	for (i = 0; i < r->hdr.func_cnt; i++) {
+		struct replay_func *f = &r->funcs[i];
+
+		if (replayer__read(r, &rf, sizeof(rf)))
+			goto err_func;
+
+		f->addr = rf.addr;
+		f->size = rf.size;
+		f->flags = rf.flags;
+		f->name = replayer__read_str(r, rf.name_len);
+		if (!f->name)
+			goto err_func;
+		if (rf.mod_len) {
+			f->module = replayer__read_str(r, rf.mod_len);
+			if (!f->module)
+				goto err_func;
+		}
+	}
+
+	return r;
+
+err_func:
+	fprintf(stderr, "Failed to read function table from '%s'\n", path);
+err_out:
+	replayer__free(r);
+	return NULL;
+}
+
+void replayer__free(struct replayer *r)
+{
+	int i;
+
+	if (!r)
+		return;
+
+	if (r->f)
+		fclose(r->f);
+	for (i = 0; r->funcs && i < r->hdr.func_cnt; i++) {
+		free(r->funcs[i].name);
+		free(r->funcs[i].module);
+	}
+	free(r->funcs);
+	free(r->kallsyms);
+	ft_states_free(r->ft_states);
+	flow_dict_free(&r->flows);
+	free(r->rec);
+	free(r->buf);
+	free(r);
+}
+
+const struct record_hdr *replayer__hdr(const struct replayer *r)
+{
+	return &r->hdr;
+}
+
+const char *replayer__kallsyms(const struct replayer *r, size_t *sz)
+{
+	*sz = r->hdr.kallsyms_sz;
+	return r->kallsyms;
+}
+
+const struct replay_func *replayer__funcs(const struct replayer *r, int *cnt)
+{
+	*cnt = r->hdr.func_cnt;
+	return r->funcs;
+}
+
+/* Read next raw record. Returns 1 if record was read, 0 at the end of
+ * recording, or negative error. Returned data stays valid until the next
+ * call.
+ */
+static int replayer__reserve(struct replayer *r, size_t sz)
+{
+	void *tmp;
+
+	if (sz <= r->rec_cap)
+		return 0;
+
+	/* malloc() guarantees alignment suitable for any record */
+	tmp = realloc(r->rec, sz);
+	if (!tmp)
+		return -ENOMEM;
+	r->rec = tmp;
+	r->rec_cap = sz;
+	return 0;
+}
+
+static int replayer__decode_ft(struct replayer *r, int tag, struct func_trace_entry *fe)
+{
+	__u64 pid, ts, seq_id, depth, func_id, lat = 0, res = 0, self_lat = 0;
+	__u64 offcpu_lat = 0, idx;
+	struct ft_state *st;
+	int err;
+
+	err = replayer__read_varint(r, &pid);
+	err = err ?: replayer__read_varint(r, &ts);
+	err = err ?: replayer__read_varint(r, &seq_id);
+	err = err ?: replayer__read_varint(r, &depth);
+	err = err ?: replayer__read_varint(r, &func_id);
+	if (tag == REC_TAG_FT_EXIT) {
+		err = err ?: replayer__read_varint(r, &lat);
+		err = err ?: replayer__read_varint(r, &res);
+		err = err ?: replayer__read_varint(r, &self_lat);
+		err = err ?: replayer__read_varint(r, &offcpu_lat);
+	}
+	err = err ?: replayer__read_varint(r, &idx);
+	if (err)
+		return err;
+
+	if (idx == 0) {
+		struct flow_tuple *f;
+
+		err = flow_dict_reserve(&r->flows);
+		if (err)
+			return err;
+		f = &r->flows.flows[r->flows.cnt];
+		err = replayer__read(r, &f->saddr, 4);
+		err = err ?: replayer__read(r, &f->daddr, 4);
+		err = err ?: replayer__read(r, &f->sport, 2);
+		err = err ?: replayer__read(r, &f->dport, 2);
+		if (err)
+			return err;
+		idx = r->flows.cnt++;
+	} else if (--idx >= r->flows.cnt) {
+		return -EINVAL;
+	}
+
+	st = ft_state_get(r->ft_states, pid);
+	if (!st)
+		return -ENOMEM;
+
+	memset(fe, 0, sizeof(*fe));
+	fe->type = tag == REC_TAG_FT_ENTRY ? REC_FUNC_TRACE_ENTRY : REC_FUNC_TRACE_EXIT;
+	fe->pid = pid;
+	fe->ts = st->ts += unzigzag(ts);
+	fe->seq_id = st->seq_id += unzigzag(seq_id);
+	fe->depth = st->depth += unzigzag(depth);
+	fe->func_id = func_id;
+	fe->func_lat = unzigzag(lat);
+	fe->func_res = unzigzag(res);
+	fe->func_self_lat = unzigzag(self_lat);
+	fe->func_offcpu_lat = unzigzag(offcpu_lat);
+	fe->flow_info = r->flows.flows[idx];
+	ft_state_put(r->ft_states, fe);
+
+	return 0;
+}
+
+static bool ids_valid(const unsigned short *ids, unsigned cnt, int func_cnt)
+{
+	unsigned i;
+
+	for (i = 0; i < cnt; i++) {
+		if (ids[i] >= func_cnt)
+			return false;
+	}
+	return true;
+}
+
+/* Validate record sizes, depths, and function IDs, so that the rest of
+ * retsnoop can process replayed records exactly as it does live ones
+ */
+static bool replayer__rec_valid(const struct replayer *r, const void *data, size_t sz)
+{
+	const struct func_trace_entry *fe = data;
+	const struct call_stack *s = data;
+	int func_cnt = r->hdr.func_cnt;
+
+	if (sz < sizeof(enum rec_type))
+		return false;
+
+	switch (*(const enum rec_type *)data) {
+	case REC_CALL_STACK:
+		return sz == sizeof(*s) &&
+		       s->depth <= s->max_depth && s->max_depth <= MAX_FSTACK_DEPTH &&
+		       s->saved_depth <= MAX_FSTACK_DEPTH + 1 &&
+		       s->saved_max_depth <= MAX_FSTACK_DEPTH &&
+		       ids_valid(s->func_ids, s->max_depth, func_cnt) &&
+		       ids_valid(s->saved_ids, s->saved_max_depth, func_cnt) &&
+		       s->kstack_sz <= (long)sizeof(s->kstack) &&
+		       s->lbrs_sz <= (long)sizeof(s->lbrs);
+	case REC_FUNC_TRACE_START:
+		return sz == sizeof(struct func_trace_start);
+	case REC_OFFCPU_STACK:
+		return sz == sizeof(struct offcpu_stack);
+	case REC_FUNC_TRACE_ENTRY:
+	case REC_FUNC_TRACE_EXIT:
+		return sz == sizeof(*fe) && fe->func_id < func_cnt &&
+		       fe->depth > 0 && fe->depth <= MAX_FSTACK_DEPTH;
+	default:
+		return false;
+	}
+}
+
+int replayer__next(struct replayer *r, void **data, size_t *data_sz)
+{
+	__u64 sz;
+	int err, tag;
+
+	tag = getc_unlocked(r->f);
+	if (tag == EOF)
+		return ferror(r->f) ? -EIO : 0;
+
+	switch (tag) {
+	case REC_TAG_FT_ENTRY:
+	case REC_TAG_FT_EXIT:
+		sz = sizeof(struct func_trace_entry);
+		err = replayer__reserve(r, sz);
+		if (err)
+			return err;
+		err = replayer__decode_ft(r, tag, r->rec);
+		break;
+	case REC_TAG_RAW:
+		err = replayer__read_varint(r, &sz);
+		if (!err && sz > RECORD_RAW_MAX_SZ)
+			err = -EINVAL;
+		err = err ?: replayer__reserve(r, sz);
+		err = err ?: replayer__read(r, r->rec, sz);
+		break;
+	default:
+		fprintf(stderr, "Unrecognized record tag %d\n", tag);
+		return -EINVAL;
+	}
+	if (err == -ENOMEM)
+		return err;
+	if (err == -EINVAL) {
+		fprintf(stderr, "Corrupted record tagged %d in recording\n", tag);
+		return err;
+	}
+	if (err) {
+		/* recording might have been cut short, e.g., by full disk */
+		fprintf(stderr, "Truncated record at the end of recording, ignoring.\n");
+		return 0;
+	}
+	if (!replayer__rec_valid(r, r->rec, sz)) {
+		fprintf(stderr, "Invalid record of size %llu in recording\n", (unsigned long long)sz);
+		return -EINVAL;
+	}
+	if (tag == REC_TAG_RAW)
+		ft_state_start(r->ft_states, r->rec, sz);
+
+	*data = r->rec;
+	*data_sz = sz;
+	return 1;
+}
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __RECORD_H
+#define __RECORD_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+/*
+ * Recording file layout (all integers are in host byte order, recordings are
+ * meant to be replayed on the same architecture):
+ *
+ *   struct record_hdr;
+ *   kallsyms snapshot (hdr.kallsyms_sz bytes of raw /proc/kallsyms text);
+ *   hdr.func_cnt times:
+ *     struct record_func;
+ *     function name (name_len bytes, not zero-terminated);
+ *     module name (mod_len bytes, not zero-terminated);
+ *   until EOF:
+ *     __u8 record tag (enum record_tag);
+ *     tag-specific record payload;
+ *
+ * REC_TAG_RAW records are stored as varint size followed by raw BPF record
+ * as received from ringbuf/perfbuf. Function trace entry/exit records, which
+ * make up the bulk of a recording in -T mode, are encoded compactly relative
+ * to the previous record of the same task (or to all-zero state, for the
+ * first record after task's outermost function exit or after task's
+ * REC_FUNC_TRACE_START record):
+ *
+ *   varint pid;
+ *   zigzag varint ts, seq_id, and depth deltas;
+ *   varint func_id;
+ *   zigzag varint func_lat, func_res, func_self_lat, and func_offcpu_lat
+ *   (REC_TAG_FT_EXIT only);
+ *   varint flow tuple dictionary index + 1, or 0 followed by new flow tuple
+ *   (saddr, daddr, sport, dport), which gets next dictionary index;
+ */
+#define RECORD_MAGIC 0x504e5352 /* "RSNP" */
+#define RECORD_VERSION 1
+
+enum record_tag {
+	REC_TAG_RAW,
+	REC_TAG_FT_ENTRY,
+	REC_TAG_FT_EXIT,
+};
+
+#define BUILD_ID_MAX_SZ 20
+
+struct record_hdr {
+	__u32 magic;
+	__u32 version;
+	__u32 hdr_sz;
+	__u32 func_cnt;
+	__u64 ktime_off;
+	__u64 kallsyms_sz;
+	__u32 build_id_sz;
+	__u8 build_id[BUILD_ID_MAX_SZ];
+};
+
+struct record_func {
+	__u64 addr;
+	__u64 size;
+	__u32 flags;
+	__u16 name_len;
+	__u16 mod_len;
+};
+
+struct recorder;
+
+struct recorder *recorder__new(const char *path, __u64 ktime_off, int func_cnt);
+void recorder__free(struct recorder *r);
+
+int recorder__add_func(struct recorder *r, const char *name, const char *module,
+		       long addr, long size, int flags);
+int recorder__write(struct recorder *r, const void *data, size_t data_sz);
+
+size_t recorder__record_cnt(const struct recorder *r);
+size_t recorder__byte_cnt(const struct recorder *r);
+
+struct replay_func {
+	char *name;
+	char *module;
+	long addr;
+	long size;
+	int flags;
+};
+
+struct replayer;
+
+struct replayer *replayer__open(const char *path);
+void replayer__free(struct replayer *r);
+
+const struct record_hdr *replayer__hdr(const struct replayer *r);
+const char *replayer__kallsyms(const struct replayer *r, size_t *sz);
+const struct replay_func *replayer__funcs(const struct replayer *r, int *cnt);
+
+int replayer__next(struct replayer *r, void **data, size_t *data_sz);
+
+#endif /* __RECORD_H */
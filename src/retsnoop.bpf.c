@@ -34,6 +34,13 @@ struct {
 	__type(key, __u32);
 	__type(value, struct call_stack);
 } stacks SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, __u32);
+	__type(value, struct offcpu_stack);
+	__uint(max_entries, 1); /* sized from user-space with --offcpu */
+} offcpu_stacks SEC(".maps");
 //------新变量------
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -67,6 +74,7 @@ const volatile int targ_tgid = 0;
 const volatile bool emit_success_stacks = false;
 const volatile bool emit_intermediate_stacks = false;
 const volatile bool emit_func_trace = false;
+const volatile bool use_offcpu = false;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -75,32 +83,84 @@ struct {
 	__uint(max_entries, 1); /* could be overriden from user-space */
 } tgids_filter SEC(".maps");
 
-const volatile __u32 tgid_allow_cnt = 0;
-const volatile __u32 tgid_deny_cnt = 0;
-
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
-	__type(key, int);
-	__type(value, char[TASK_COMM_LEN]);
+	__type(key, char[TASK_COMM_LEN]);
+	__type(value, bool);
 	__uint(max_entries, 1); /* could be overriden from user-space */
 } comms_filter SEC(".maps");
 
-const volatile __u32 comm_allow_cnt = 0;
-const volatile __u32 comm_deny_cnt = 0;
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, __u64);
+	__type(value, bool);
+	__uint(max_entries, 1); /* could be overriden from user-space */
+} cgroups_filter SEC(".maps");
+
+const volatile bool use_cgroup_filter = false;
+
+/* allow/deny counts of filter maps, updated by user-space at runtime */
+struct filter_state filters = {};
 
 const volatile __u64 duration_ns = 0;
 
-char func_names[MAX_FUNC_CNT][MAX_FUNC_NAME_LEN] = {};
-__u64 func_ips[MAX_FUNC_CNT] = {};
-int func_flags[MAX_FUNC_CNT] = {};
+/* kept compact (64KB for 64K functions), as it's looked up on each probe */
+__u8 func_flags[MAX_FUNC_CNT] = {};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct func_debug_info);
+	__uint(max_entries, 1); /* sized and filled from user-space with -l */
+} func_debug_infos SEC(".maps");
+
+static __always_inline const char *func_debug_name(u32 id)
+{
+	struct func_debug_info *info;
+
+	info = bpf_map_lookup_elem(&func_debug_infos, &id);
+	return info ? info->name : "???";
+}
 
 const volatile char spaces[512] = {};
 
 /* provided by mass_attach.bpf.c */
 int copy_lbrs(void *dst, size_t dst_sz);
 
+/* use_offcpu is read-only variable, so without --offcpu all the off-CPU
+ * accounting is eliminated as dead code by verifier
+ */
+static __always_inline struct offcpu_stack *get_offcpu_stack(u32 pid)
+{
+	if (!use_offcpu)
+		return NULL;
+
+	return bpf_map_lookup_elem(&offcpu_stacks, &pid);
+}
+
+static __always_inline void delete_stack(u32 pid)
+{
+	bpf_map_delete_elem(&stacks, &pid);
+	if (use_offcpu)
+		bpf_map_delete_elem(&offcpu_stacks, &pid);
+}
+
+static __always_inline int output_rec(void *ctx, void *map, void *data, size_t data_sz)
+{
+	/* use_ringbuf is read-only variable, so verifier will detect which of
+	 * the branch is dead code and will eliminate it, so on old kernels
+	 * bpf_ringbuf_output() won't be present in the resulting code
+	 */
+	if (use_ringbuf)
+		return bpf_ringbuf_output(map, data, data_sz, 0);
+	else
+		return bpf_perf_event_output(ctx, map, BPF_F_CURRENT_CPU, data, data_sz);
+}
+
 static __always_inline int output_stack(void *ctx, void *map, struct call_stack *stack)
 {
+	struct offcpu_stack *oc;
+
 	stack->emit_ts = bpf_ktime_get_ns();
 
 	if (duration_ns && stack->emit_ts - stack->func_lat[0] < duration_ns)
@@ -111,18 +171,17 @@ static __always_inline int output_stack(void *ctx, void *map, struct call_stack
 		stack->lbrs_sz = copy_lbrs(&stack->lbrs, sizeof(stack->lbrs));
 	}
 
-	/* use_ringbuf is read-only variable, so verifier will detect which of
-	 * the branch is dead code and will eliminate it, so on old kernels
-	 * bpf_ringbuf_output() won't be present in the resulting code
-	 */
-	if (use_ringbuf)
-		return bpf_ringbuf_output(map, stack, sizeof(*stack), 0);
-	else
-		return bpf_perf_event_output(ctx, map, BPF_F_CURRENT_CPU, stack, sizeof(*stack));
+	/* user-space expects off-CPU times right before their call stack */
+	oc = get_offcpu_stack(stack->pid);
+	if (oc)
+		output_rec(ctx, map, oc, sizeof(*oc));
+
+	return output_rec(ctx, map, stack, sizeof(*stack));
 }
 
 static __noinline void save_stitch_stack(void *ctx, struct call_stack *stack)
 {
+	struct offcpu_stack *oc = get_offcpu_stack(stack->pid);
 	u64 d = stack->depth;
 	u64 len = stack->max_depth - d;
 
@@ -141,6 +200,9 @@ static __noinline void save_stitch_stack(void *ctx, struct call_stack *stack)
 		bpf_probe_read(stack->saved_ids + d, len * sizeof(stack->saved_ids[0]), stack->func_ids + d);
 		bpf_probe_read(stack->saved_res + d, len * sizeof(stack->saved_res[0]), stack->func_res + d);
 		bpf_probe_read(stack->saved_lat + d, len * sizeof(stack->saved_lat[0]), stack->func_lat + d);
+		bpf_probe_read(stack->saved_self + d, len * sizeof(stack->saved_self[0]), stack->func_self + d);
+		if (oc)
+			bpf_probe_read(oc->saved_offcpu + d, len * sizeof(oc->saved_offcpu[0]), oc->func_offcpu + d);
 		stack->saved_depth = stack->depth + 1;
 		if (extra_verbose)
 			bpf_printk("STITCHED STACK %d..%d to ..%d\n",
@@ -161,12 +223,113 @@ static __noinline void save_stitch_stack(void *ctx, struct call_stack *stack)
 	bpf_probe_read(stack->saved_ids + d, len * sizeof(stack->saved_ids[0]), stack->func_ids + d);
 	bpf_probe_read(stack->saved_res + d, len * sizeof(stack->saved_res[0]), stack->func_res + d);
 	bpf_probe_read(stack->saved_lat + d, len * sizeof(stack->saved_lat[0]), stack->func_lat + d);
+	bpf_probe_read(stack->saved_self + d, len * sizeof(stack->saved_self[0]), stack->func_self + d);
+	if (oc)
+		bpf_probe_read(oc->saved_offcpu + d, len * sizeof(oc->saved_offcpu[0]), oc->func_offcpu + d);
 
 	stack->saved_depth = stack->depth + 1;
 	stack->saved_max_depth = stack->max_depth;
 }
 
+static __always_inline bool tgid_allowed(void)
+{
+	bool *verdict_ptr;
+	u32 tgid;
+
+	/* if no PID filters -- allow everything */
+	if (!filters.tgid_allowlist && filters.tgid_deny_cnt == 0)
+		return true;
+
+	tgid = bpf_get_current_pid_tgid() >> 32;
+
+	verdict_ptr = bpf_map_lookup_elem(&tgids_filter, &tgid);
+	if (!verdict_ptr)
+		/* in allowlist mode PID didn't pass the check */
+		return !filters.tgid_allowlist;
+
+	return *verdict_ptr;
+}
+
+static __always_inline bool comm_allowed(void)
+{
+	char comm[TASK_COMM_LEN] = {};
+	bool *verdict_ptr;
+
+	/* if no COMM filters -- allow everything */
+	if (!filters.comm_allowlist && filters.comm_deny_cnt == 0)
+		return true;
+
+	bpf_get_current_comm(comm, TASK_COMM_LEN);
+
+	verdict_ptr = bpf_map_lookup_elem(&comms_filter, comm);
+	if (!verdict_ptr)
+		/* in allowlist mode COMM didn't pass the check */
+		return !filters.comm_allowlist;
+
+	return *verdict_ptr;
+}
+
+static __always_inline bool cgroup_allowed(void)
+{
+	bool *verdict_ptr;
+	u64 cgid;
+	int level;
+
+	/* if no cgroup filters -- allow everything */
+	if (!use_cgroup_filter || (!filters.cgroup_allowlist && filters.cgroup_deny_cnt == 0))
+		return true;
+
+	/* filter of the innermost cgroup containing current task wins, so
+	 * check task's own cgroup first, then its ancestors bottom up, but
+	 * only at levels that have any filters
+	 */
+	cgid = bpf_get_current_cgroup_id();
+	verdict_ptr = bpf_map_lookup_elem(&cgroups_filter, &cgid);
+	if (verdict_ptr)
+		return *verdict_ptr;
+
+	for (level = MAX_CGROUP_LEVEL - 1; level >= 0; level--) {
+		if (!(filters.cgroup_levels & (1U << level)))
+			continue;
+
+		cgid = bpf_get_current_ancestor_cgroup_id(level);
+		verdict_ptr = bpf_map_lookup_elem(&cgroups_filter, &cgid);
+		if (verdict_ptr)
+			return *verdict_ptr;
+	}
+
+	/* in allowlist mode cgroup didn't pass the check */
+	return !filters.cgroup_allowlist;
+}
+
+static __always_inline bool task_allowed(void)
+{
+	return tgid_allowed() && comm_allowed() && cgroup_allowed();
+}
+
+/* Filters are evaluated once, when call stack is created at entry function,
+ * so existing call stack means task passed the filters. Re-check only if
+ * filters were changed since then and drop call stack if task doesn't pass
+ * them anymore.
+ */
+static __always_inline bool stack_allowed(struct call_stack *stack, u32 pid)
+{
+	u64 gen = filters.gen;
+
+	if (stack->filter_gen == gen)
+		return true;
+
+	if (!task_allowed()) {
+		delete_stack(pid);
+		return false;
+	}
+
+	stack->filter_gen = gen;
+	return true;
+}
+
 static const struct call_stack empty_stack;
+static const struct offcpu_stack empty_offcpu_stack;
 
 static __noinline bool push_call_stack(void *ctx, u32 id, u64 ip)
 {
@@ -174,14 +337,26 @@ static __noinline bool push_call_stack(void *ctx, u32 id, u64 ip)
 	u64 pid_tgid = bpf_get_current_pid_tgid();
 	u32 pid = (u32)pid_tgid;
 	struct call_stack *stack;
+	struct offcpu_stack *oc;
 	u64 d;
 
 	stack = bpf_map_lookup_elem(&stacks, &pid);
+	/* stack can be left behind by a task that exited in the middle of
+	 * traced function, with its TID now reused by another process, or
+	 * be empty; either way start from scratch and re-evaluate filters
+	 */
+	if (stack && (stack->tgid != (u32)(pid_tgid >> 32) || stack->depth == 0)) {
+		delete_stack(pid);
+		stack = NULL;
+	}
 	if (!stack) {
 		struct task_struct *tsk;
+		u64 gen = filters.gen;
 
 		if (!(func_flags[id & MAX_FUNC_MASK] & FUNC_IS_ENTRY))
 			return false;
+		if (!task_allowed())
+			return false;
 
 		bpf_map_update_elem(&stacks, &pid, &empty_stack, BPF_ANY);
 		stack = bpf_map_lookup_elem(&stacks, &pid);
@@ -192,10 +367,20 @@ static __noinline bool push_call_stack(void *ctx, u32 id, u64 ip)
 		stack->start_ts = bpf_ktime_get_ns();
 		stack->pid = pid;
 		stack->tgid = (u32)(pid_tgid >> 32);
+		stack->filter_gen = gen;
 		bpf_get_current_comm(&stack->task_comm, sizeof(stack->task_comm));
 		tsk = (void *)bpf_get_current_task();
 		BPF_CORE_READ_INTO(&stack->proc_comm, tsk, group_leader, comm);
 
+		if (use_offcpu) {
+			bpf_map_update_elem(&offcpu_stacks, &pid, &empty_offcpu_stack, BPF_ANY);
+			oc = bpf_map_lookup_elem(&offcpu_stacks, &pid);
+			if (oc) {
+				oc->type = REC_OFFCPU_STACK;
+				oc->pid = pid;
+			}
+		}
+
 		if (emit_func_trace) {
 			struct func_trace_start *r;
 
@@ -207,6 +392,8 @@ static __noinline bool push_call_stack(void *ctx, u32 id, u64 ip)
 				bpf_ringbuf_submit(r, 0);
 			}
 		}
+	} else if (!stack_allowed(stack, pid)) {
+		return false;
 	}
     //初始化call_stack后，其depth为0
 	d = stack->depth;
@@ -222,23 +409,29 @@ static __noinline bool push_call_stack(void *ctx, u32 id, u64 ip)
 	stack->depth = d + 1;
 	stack->max_depth = d + 1;
 	stack->func_lat[d] = bpf_ktime_get_ns();
+	stack->func_self[d] = 0;
 	stack->next_seq_id++;
 
+	oc = get_offcpu_stack(pid);
+	if (oc)
+		oc->func_offcpu[d] = 0;
+
     //每有一个新的函数存入调用栈
 	if (emit_func_trace) {
         //--------测试------
         struct flow_tuple flow_entity = {1,1,1,1};
+        struct func_trace_entry *fe;
         //查询当前线程对应的tcp_transmit_skb函数递归深度(每次递归产生的流信息不同)
         u64 *tcp_d_ptr = bpf_map_lookup_elem(&pid_to_tcp_depth,&pid);
         if(tcp_d_ptr == NULL){
-            return -1;
+            goto skip_ft_entry;
         }
         u32 tcp_d = *tcp_d_ptr;
         // struct flow_tuple *flow = bpf_map_lookup_elem(&array_ptof.values[*tcp_d_ptr],&pid);
         //根据深度拿到当前深度对应的 pid<->flow四元组 的map
         struct inner_map *pid_to_flow = bpf_map_lookup_elem(&array_ptof,&tcp_d);
         if(pid_to_flow == NULL){
-            return -1;
+            goto skip_ft_entry;
         }
         //查询该map，找到当前线程对应的流信息，即为当前函数调用栈所发送的流
         struct flow_tuple *flow = bpf_map_lookup_elem(pid_to_flow,&pid);
@@ -250,8 +443,6 @@ static __noinline bool push_call_stack(void *ctx, u32 id, u64 ip)
         }
         //--------测试------
         //将该函数需要打印的信息，封装成func_trace_entry(fe)，传送给用户态
-		struct func_trace_entry *fe;
-
 		fe = bpf_ringbuf_reserve(&rb, sizeof(*fe), 0);
 		if (!fe)
 			goto skip_ft_entry;
@@ -271,7 +462,7 @@ skip_ft_entry:;
 	}
 
 	if (verbose) {
-		const char *func_name = func_names[id & MAX_FUNC_MASK];
+		const char *func_name = func_debug_name(id);
 
 		if (printk_is_sane) {
 			if (d == 0)
@@ -342,7 +533,7 @@ char FMT_SUCC_INT_COMPAT[]   = "    EXIT  [%d] %s [%d]    ";
 
 static __noinline void print_exit(void *ctx, __u32 d, __u32 id, long res)
 {
-	const char *func_name = func_names[id & MAX_FUNC_MASK];
+	const char *func_name = func_debug_name(id);
 	const size_t FMT_MAX_SZ = sizeof(FMT_SUCC_PTR_COMPAT); /* UPDATE IF NECESSARY */
 	u32 flags, fmt_sz;
 	const char *fmt;
@@ -420,16 +611,16 @@ static __noinline void print_exit(void *ctx, __u32 d, __u32 id, long res)
 static __noinline bool pop_call_stack(void *ctx, u32 id, u64 ip, long res)
 {
     // bpf_printk("retsnoop_exit");
-	const char *func_name = func_names[id & MAX_FUNC_MASK];
 	struct call_stack *stack;
+	struct offcpu_stack *oc;
 	u32 pid, exp_id, flags, fmt_sz;
 	const char *fmt;
 	bool failed;
-	u64 d, lat;
+	u64 d, lat, self_lat, offcpu_lat;
 
 	pid = (u32)bpf_get_current_pid_tgid();
 	stack = bpf_map_lookup_elem(&stacks, &pid);
-	if (!stack)
+	if (!stack || !stack_allowed(stack, pid))
 		return false;
 
 	stack->next_seq_id++;
@@ -455,19 +646,30 @@ static __noinline bool pop_call_stack(void *ctx, u32 id, u64 ip, long res)
 		failed = IS_ERR_VALUE(res);
 
 	lat = bpf_ktime_get_ns() - stack->func_lat[d];
+	/* func_self[d] accumulated latencies of completed children so far */
+	self_lat = lat - stack->func_self[d];
+	/* func_offcpu[d] accumulated off-CPU time while frame was innermost,
+	 * plus inclusive off-CPU time of completed children
+	 */
+	oc = get_offcpu_stack(pid);
+	offcpu_lat = oc ? oc->func_offcpu[d] : 0;
 
 	if (emit_func_trace) {
                 //--------测试------
+        struct func_trace_entry *fe;
+        /* returning early would leave the frame on the stack forever, so
+         * only skip trace record
+         */
         u64 *tcp_d_ptr = bpf_map_lookup_elem(&pid_to_tcp_depth,&pid);
         if(tcp_d_ptr == NULL){
-            return -1;
+            goto skip_ft_exit;
         }
         u32 tcp_d = *tcp_d_ptr;
         struct flow_tuple flow_entity = {1,1,1,1};
         // struct flow_tuple *flow = bpf_map_lookup_elem(&array_ptof.value[*tcp_d_ptr],&pid);
         struct inner_map *pid_to_flow = bpf_map_lookup_elem(&array_ptof,&tcp_d);
         if(pid_to_flow == NULL){
-            return -1;
+            goto skip_ft_exit;
         }
         struct flow_tuple *flow = bpf_map_lookup_elem(pid_to_flow,&pid);
         if(flow != NULL){
@@ -476,7 +678,6 @@ static __noinline bool pop_call_stack(void *ctx, u32 id, u64 ip, long res)
             flow_entity.daddr = flow->daddr;
             flow_entity.dport = flow->dport;
         }
-		struct func_trace_entry *fe;
 
 		fe = bpf_ringbuf_reserve(&rb, sizeof(*fe), 0);
 		if (!fe)
@@ -492,6 +693,8 @@ static __noinline bool pop_call_stack(void *ctx, u32 id, u64 ip, long res)
 		fe->func_id = id;
 		fe->func_lat = lat;
 		fe->func_res = res;
+		fe->func_self_lat = self_lat;
+		fe->func_offcpu_lat = offcpu_lat;
 
 		bpf_ringbuf_submit(fe, 0);
 skip_ft_exit:;
@@ -501,21 +704,17 @@ skip_ft_exit:;
 
 	exp_id = stack->func_ids[d];
 	if (exp_id != id) {
-		const char *exp_func_name = func_names[exp_id & MAX_FUNC_MASK];
-		u64 exp_ip;
-
-		if (exp_id < MAX_FUNC_CNT)
-			exp_ip = func_ips[exp_id];
-		else
-			exp_ip = 0;
-
 		if (verbose) {
+			struct func_debug_info *exp_info;
+
+			exp_info = bpf_map_lookup_elem(&func_debug_infos, &exp_id);
 			bpf_printk("POP(0) UNEXPECTED PID %d DEPTH %d MAX DEPTH %d",
 				   pid, stack->depth, stack->max_depth);
 			bpf_printk("POP(1) UNEXPECTED GOT  ID %d ADDR %lx NAME %s",
-				   id, ip, func_name);
+				   id, ip, func_debug_name(id));
 			bpf_printk("POP(2) UNEXPECTED WANT ID %u ADDR %lx NAME %s",
-				   exp_id, exp_ip, exp_func_name);
+				   exp_id, exp_info ? exp_info->ip : 0,
+				   exp_info ? exp_info->name : "???");
 		}
 
 		stack->depth = 0;
@@ -524,13 +723,19 @@ skip_ft_exit:;
 		stack->kstack_sz = 0;
 		stack->lbrs_sz = 0;
 
-		bpf_map_delete_elem(&stacks, &pid);
+		delete_stack(pid);
 
 		return false;
 	}
 
 	stack->func_res[d] = res;
 	stack->func_lat[d] = lat;
+	stack->func_self[d] = self_lat;
+	if (d > 0) {
+		stack->func_self[d - 1] += lat;
+		if (oc)
+			oc->func_offcpu[d - 1] += offcpu_lat;
+	}
 
 	if (failed && !stack->is_err) {
 		stack->is_err = true;
@@ -563,56 +768,15 @@ skip_ft_exit:;
 		stack->kstack_sz = 0;
 		stack->lbrs_sz = 0;
 
-		bpf_map_delete_elem(&stacks, &pid);
+		delete_stack(pid);
 	}
 
 	return true;
 }
 
-static __always_inline bool tgid_allowed(void)
-{
-	bool *verdict_ptr;
-	u32 tgid;
-
-	/* if no PID filters -- allow everything */
-	if (tgid_allow_cnt + tgid_deny_cnt == 0)
-		return true;
-
-	tgid = bpf_get_current_pid_tgid() >> 32;
-
-	verdict_ptr = bpf_map_lookup_elem(&tgids_filter, &tgid);
-	if (!verdict_ptr)
-		/* if allowlist is non-empty, then PID didn't pass the check */
-		return tgid_allow_cnt == 0;
-
-	return *verdict_ptr;
-}
-
-static __always_inline bool comm_allowed(void)
-{
-	char comm[TASK_COMM_LEN] = {};
-	bool *verdict_ptr;
-
-	/* if no COMM filters -- allow everything */
-	if (comm_allow_cnt + comm_deny_cnt == 0)
-		return true;
-
-	bpf_get_current_comm(comm, TASK_COMM_LEN);
-
-	verdict_ptr = bpf_map_lookup_elem(&comms_filter, comm);
-	if (!verdict_ptr)
-		/* if allowlist is non-empty, then COMM didn't pass the check */
-		return comm_allow_cnt == 0;
-
-	return *verdict_ptr;
-}
-
 /* mass-attacher BPF library is calling this function, so it should be global */
 __hidden int handle_func_entry(void *ctx, u32 func_id, u64 func_ip)
 {
-	if (!tgid_allowed() || !comm_allowed())
-		return 0;
-
 	push_call_stack(ctx, func_id, func_ip);
 	return 0;
 }
@@ -620,10 +784,44 @@ __hidden int handle_func_entry(void *ctx, u32 func_id, u64 func_ip)
 /* mass-attacher BPF library is calling this function, so it should be global */
 __hidden int handle_func_exit(void *ctx, u32 func_id, u64 func_ip, u64 ret)
 {
-	if (!tgid_allowed() || !comm_allowed())
+	pop_call_stack(ctx, func_id, func_ip, ret);
+	return 0;
+}
+
+/* Attribute time task spends switched out to the innermost active frame of
+ * its call stack. Only loaded and attached with --offcpu. Both preemption and
+ * voluntary sleep count as off-CPU time.
+ */
+SEC("tp_btf/sched_switch")
+int BPF_PROG(handle_sched_switch, bool preempt, struct task_struct *prev, struct task_struct *next)
+{
+	struct call_stack *stack;
+	struct offcpu_stack *oc;
+	u32 pid;
+	u64 now, d;
+
+	if (!use_offcpu)
 		return 0;
 
-	pop_call_stack(ctx, func_id, func_ip, ret);
+	now = bpf_ktime_get_ns();
+
+	pid = prev->pid;
+	oc = bpf_map_lookup_elem(&offcpu_stacks, &pid);
+	if (oc)
+		oc->offcpu_ts = now;
+
+	pid = next->pid;
+	oc = bpf_map_lookup_elem(&offcpu_stacks, &pid);
+	if (!oc || !oc->offcpu_ts)
+		return 0;
+
+	stack = bpf_map_lookup_elem(&stacks, &pid);
+	d = stack ? stack->depth : 0;
+	barrier_var(d);
+	if (d > 0 && d <= MAX_FSTACK_DEPTH)
+		oc->func_offcpu[d - 1] += now - oc->offcpu_ts;
+	oc->offcpu_ts = 0;
+
 	return 0;
 }
 
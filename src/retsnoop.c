@@ -2,7 +2,9 @@
 /* Copyright (c) 2021 Facebook */
 #include <argp.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <limits.h>
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
@@ -16,18 +18,49 @@
 #include <time.h>
 #include "retsnoop.h"
 #include "retsnoop.skel.h"
-#include "calib_feat.skel.h"
+#include "kernel_features.h"
 #include "ksyms.h"
 #include "addr2line.h"
 #include "mass_attacher.h"
 #include "utils.h"
 #include "hashmap.h"
+#include "record.h"
+#include "output.h"
+#include "trace_export.h"
+#include "folded.h"
+#include "startup_prof.h"
+#include "filters.h"
+
+/* Per-function metadata for all traced functions. It is resolved once, as
+ * soon as the set of traced functions is known, so that event processing
+ * doesn't need to go to mass_attacher, BPF skeleton, or symbolizer for it.
+ */
+struct func_meta {
+	const char *name;
+	const char *module;
+	long addr;
+	long size;
+	int flags;
+	/* source code location of function itself (e.g.,
+	 * 'kernel/bpf/syscall.c:4749:1'), if symbolization is enabled;
+	 * could also be prepended with original function name, if it
+	 * doesn't match kernel symbol name, e.g.:
+	 * 'my_actual_func @ kernel/bpf/syscall.c:4749:1'
+	 */
+	char *src;
+};
 
 struct ctx {
 	struct mass_attacher *att;
 	struct retsnoop_bpf *skel;
 	struct ksyms *ksyms;
 	struct addr2line *a2l;
+	struct recorder *rec;
+	struct trace_export *te;
+	struct folded *folded;
+
+	struct func_meta *funcs;
+	int func_cnt;
 };
 
 enum attach_mode {
@@ -37,6 +70,11 @@ enum attach_mode {
 	ATTACH_FENTRY,
 };
 
+enum folded_weight {
+	FOLDED_COUNT,
+	FOLDED_SELF_TIME,
+};
+
 enum symb_mode {
 	SYMB_NONE = -1,
 
@@ -62,8 +100,21 @@ static struct env {
 	long lbr_flags;
 	int lbr_max_cnt;
 	const char *vmlinux_path;
+	const char *record_path;
+	const char *replay_path;
+	const char *trace_export_path;
+	const char *folded_path;
+	enum folded_weight folded_weight;
+	int folded_period_s;
 	int pid;
 	int longer_than_ms;
+	long ft_mem_limit;
+	bool output_thread;
+	bool json;
+	bool offcpu;
+	bool no_plan_cache;
+	bool recalibrate;
+	const char *filter_ctl_path;
 
 	struct glob *allow_globs;
 	struct glob *deny_globs;
@@ -89,6 +140,11 @@ static struct env {
 	int allow_comm_cnt;
 	int deny_comm_cnt;
 
+	char **allow_cgroups;
+	char **deny_cgroups;
+	int allow_cgroup_cnt;
+	int deny_cgroup_cnt;
+
 	int allow_error_cnt;
 	bool has_error_filter;
 	__u64 allow_error_mask[MAX_ERR_CNT / 64];
@@ -101,12 +157,14 @@ static struct env {
 
 	int cpu_cnt;
 	bool has_branch_snapshot;
+	bool has_ancestor_cgroup_id;
 	bool has_lbr;
 	bool has_ringbuf;
 } env = {
 	.ringbuf_sz = 8 * 1024 * 1024,
 	.perfbuf_percpu_sz = 256 * 1024,
 	.stacks_map_sz = 4096,
+	.ft_mem_limit = 256 * 1024 * 1024,
 };
 
 const char *argp_program_version = "retsnoop v0.9.4";
@@ -114,12 +172,29 @@ const char *argp_program_bug_address = "Andrii Nakryiko <andrii@kernel.org>";
 const char argp_program_doc[] =
 "retsnoop tool shows kernel call stacks based on specified function filters.\n"
 "\n"
-"USAGE: retsnoop [-v] [-F|-K|-M] [-T] [--lbr] [-c CASE]* [-a GLOB]* [-d GLOB]* [-e GLOB]*\n";
+"USAGE: retsnoop [-v] [-F|-K|-M] [-T] [--lbr] [-c CASE]* [-a GLOB]* [-d GLOB]* [-e GLOB]*\n"
+"       retsnoop --replay FILE [-v] [-T] [--lbr] [-s] [-p PID]* [-n COMM]* [-L MS] [-x ERROR]*\n";
 
 #define OPT_FULL_STACKS 1001
 #define OPT_STACKS_MAP_SIZE 1002
 #define OPT_LBR_MAX_CNT 1003
 #define OPT_DRY_RUN 1004
+#define OPT_RECORD 1005
+#define OPT_REPLAY 1006
+#define OPT_TRACE_MEM_LIMIT 1007
+#define OPT_OUTPUT_THREAD 1008
+#define OPT_JSON 1009
+#define OPT_TRACE_EXPORT 1010
+#define OPT_FOLDED 1011
+#define OPT_FOLDED_WEIGHT 1012
+#define OPT_FOLDED_PERIOD 1013
+#define OPT_OFFCPU 1014
+#define OPT_NO_PLAN_CACHE 1015
+#define OPT_RECALIBRATE 1016
+#define OPT_STARTUP_PROFILE 1017
+#define OPT_FILTER_CTL 1018
+#define OPT_CGROUP 1019
+#define OPT_NO_CGROUP 1020
 
 static const struct argp_option opts[] = {
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
@@ -131,6 +206,23 @@ static const struct argp_option opts[] = {
 	  "Emit BPF-side logs (use `sudo cat /sys/kernel/debug/tracing/trace_pipe` to read)" },
 	{ "dry-run", OPT_DRY_RUN, NULL, 0,
 	  "Perform a dry run (don't actually load and attach BPF programs)" },
+	{ "no-plan-cache", OPT_NO_PLAN_CACHE, NULL, 0,
+	  "Don't use or update cached set of functions to attach to, always resolve it from scratch" },
+	{ "recalibrate", OPT_RECALIBRATE, NULL, 0,
+	  "Re-detect kernel features instead of using results cached for currently booted kernel" },
+	{ "startup-profile", OPT_STARTUP_PROFILE, "FORMAT", OPTION_ARG_OPTIONAL,
+	  "Report time spent in each startup phase to stderr, as a 'table' (default) or 'json'" },
+	{ "folded", OPT_FOLDED, "FILE", 0,
+	  "Aggregate reported call stacks (or function call trace paths, with -T) "
+	  "into FILE in folded stacks format, suitable for flame graphs" },
+	{ "folded-weight", OPT_FOLDED_WEIGHT, "WEIGHT", 0,
+	  "Weight folded stacks by occurrence 'count' (default) or by function 'self' time in nanoseconds" },
+	{ "folded-period", OPT_FOLDED_PERIOD, "SEC", 0,
+	  "Rewrite folded stacks file every SEC seconds, instead of only on exit" },
+	{ "json", OPT_JSON, NULL, 0,
+	  "Emit call stacks, LBRs, and function call traces as JSON objects, one per line" },
+	{ "output-thread", OPT_OUTPUT_THREAD, NULL, 0,
+	  "Write output from a dedicated thread, so that slow output file or pipe doesn't stall event processing" },
 
 	/* Attach mechanism specification */
 	{ "kprobes-multi", 'M', NULL, 0,
@@ -152,6 +244,16 @@ static const struct argp_option opts[] = {
 
 	/* Function calls trace mode settings */
 	{ "trace", 'T', NULL, 0, "Capture and emit function call traces" },
+	{ "trace-mem-limit", OPT_TRACE_MEM_LIMIT, "MB", 0,
+	  "Memory limit for in-flight function call traces (default 256MB). "
+	  "Least recently active traces are evicted when it's reached" },
+	{ "trace-export", OPT_TRACE_EXPORT, "FILE", 0,
+	  "Export function call traces into FILE in Chrome trace-event JSON format (implies -T)" },
+
+	/* Latency breakdown settings */
+	{ "offcpu", OPT_OFFCPU, NULL, 0,
+	  "Track time tasks spend off-CPU (sleeping or preempted) within traced functions "
+	  "and report it alongside function latencies" },
 
 	/* LBR mode settings */
 	{ "lbr", 'R', "SPEC", OPTION_ARG_OPTIONAL,
@@ -173,6 +275,12 @@ static const struct argp_option opts[] = {
 	  "Only trace processes with given name (COMM). Can be specified multiple times" },
 	{ "no-comm", 'N', "COMM", 0,
 	  "Skip tracing processes with given name (COMM). Can be specified multiple times" },
+	{ "cgroup", OPT_CGROUP, "PATH", 0,
+	  "Only trace tasks in given cgroup (v2) or its descendants. Can be specified multiple times" },
+	{ "no-cgroup", OPT_NO_CGROUP, "PATH", 0,
+	  "Skip tracing tasks in given cgroup (v2) or its descendants. Can be specified multiple times" },
+	{ "filter-ctl", OPT_FILTER_CTL, "PATH", 0,
+	  "Create named pipe at PATH, accepting PID, COMM, and cgroup filter updates while tracing" },
 	{ "longer", 'L', "MS", 0,
 	  "Only emit stacks that took at least a given amount of milliseconds" },
 	{ "success-stacks", 'S', NULL, 0,
@@ -192,6 +300,10 @@ static const struct argp_option opts[] = {
 	  "Emit non-filtered full stack traces" },
 	{ "stacks-map-size", OPT_STACKS_MAP_SIZE, "SIZE", 0,
 	  "Stacks map size (default 4096)" },
+	{ "record", OPT_RECORD, "FILE", 0,
+	  "Record raw events into FILE for offline processing, skipping any filtering and symbolization" },
+	{ "replay", OPT_REPLAY, "FILE", 0,
+	  "Process events previously recorded with --record from FILE, instead of tracing live kernel" },
 	{},
 };
 
@@ -217,31 +329,25 @@ static const struct preset presets[] = {
 
 static int process_cu_globs()
 {
-	int err = 0;
-	int i;
+	int err;
 
-	for (i = 0; i < env.cu_allow_glob_cnt; i++) {
-		err = append_compile_unit(env.ctx.a2l, &env.allow_globs, &env.allow_glob_cnt,
-					  env.cu_allow_globs[i], false /*mandatory*/);
-		if (err < 0)
-			return err;
-	}
+	/* each list of compile unit globs is resolved with a single sidecar query */
+	err = append_compile_units(env.ctx.a2l, &env.allow_globs, &env.allow_glob_cnt,
+				   env.cu_allow_globs, env.cu_allow_glob_cnt, false /*mandatory*/);
+	if (err < 0)
+		return err;
 
-	for (i = 0; i < env.cu_deny_glob_cnt; i++) {
-		err = append_compile_unit(env.ctx.a2l, &env.deny_globs, &env.deny_glob_cnt,
-					  env.cu_deny_globs[i], false /*mandatory*/);
-		if (err < 0)
-			return err;
-	}
+	err = append_compile_units(env.ctx.a2l, &env.deny_globs, &env.deny_glob_cnt,
+				   env.cu_deny_globs, env.cu_deny_glob_cnt, false /*mandatory*/);
+	if (err < 0)
+		return err;
 
-	for (i = 0; i < env.cu_entry_glob_cnt; i++) {
-		err = append_compile_unit(env.ctx.a2l, &env.entry_globs, &env.entry_glob_cnt,
-					  env.cu_entry_globs[i], false /*mandatory*/);
-		if (err < 0)
-			return err;
-	}
+	err = append_compile_units(env.ctx.a2l, &env.entry_globs, &env.entry_glob_cnt,
+				   env.cu_entry_globs, env.cu_entry_glob_cnt, false /*mandatory*/);
+	if (err < 0)
+		return err;
 
-	return err;
+	return 0;
 }
 
 static void err_mask_set(__u64 *err_mask, int err_value)
@@ -527,6 +633,82 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case OPT_DRY_RUN:
 		env.dry_run = true;
 		break;
+	case OPT_RECORD:
+		env.record_path = arg;
+		break;
+	case OPT_REPLAY:
+		env.replay_path = arg;
+		break;
+	case OPT_TRACE_EXPORT:
+		env.trace_export_path = arg;
+		env.emit_func_trace = true;
+		break;
+	case OPT_FOLDED:
+		env.folded_path = arg;
+		break;
+	case OPT_FOLDED_WEIGHT:
+		if (strcmp(arg, "count") == 0) {
+			env.folded_weight = FOLDED_COUNT;
+		} else if (strcmp(arg, "self") == 0) {
+			env.folded_weight = FOLDED_SELF_TIME;
+		} else {
+			fprintf(stderr, "Unrecognized folded stacks weight '%s'\n", arg);
+			return -EINVAL;
+		}
+		break;
+	case OPT_FOLDED_PERIOD:
+		errno = 0;
+		env.folded_period_s = strtol(arg, NULL, 10);
+		if (errno || env.folded_period_s <= 0) {
+			fprintf(stderr, "Invalid folded stacks period: %s\n", arg);
+			return -EINVAL;
+		}
+		break;
+	case OPT_JSON:
+		env.json = true;
+		break;
+	case OPT_OFFCPU:
+		env.offcpu = true;
+		break;
+	case OPT_NO_PLAN_CACHE:
+		env.no_plan_cache = true;
+		break;
+	case OPT_RECALIBRATE:
+		env.recalibrate = true;
+		break;
+	case OPT_CGROUP:
+		if (append_str(&env.allow_cgroups, &env.allow_cgroup_cnt, arg))
+			return -ENOMEM;
+		break;
+	case OPT_NO_CGROUP:
+		if (append_str(&env.deny_cgroups, &env.deny_cgroup_cnt, arg))
+			return -ENOMEM;
+		break;
+	case OPT_FILTER_CTL:
+		env.filter_ctl_path = arg;
+		break;
+	case OPT_STARTUP_PROFILE:
+		if (!arg || strcmp(arg, "table") == 0) {
+			startup_prof__enable(STARTUP_PROF_TABLE);
+		} else if (strcmp(arg, "json") == 0) {
+			startup_prof__enable(STARTUP_PROF_JSON);
+		} else {
+			fprintf(stderr, "Unrecognized startup profile format '%s'\n", arg);
+			return -EINVAL;
+		}
+		break;
+	case OPT_OUTPUT_THREAD:
+		env.output_thread = true;
+		break;
+	case OPT_TRACE_MEM_LIMIT:
+		errno = 0;
+		env.ft_mem_limit = strtol(arg, NULL, 10);
+		if (errno || env.ft_mem_limit <= 0 || env.ft_mem_limit > (LONG_MAX >> 20)) {
+			fprintf(stderr, "Invalid function trace memory limit: %s\n", arg);
+			return -EINVAL;
+		}
+		env.ft_mem_limit *= 1024 * 1024;
+		break;
 	case ARGP_KEY_ARG:
 		argp_usage(state);
 		break;
@@ -636,11 +818,13 @@ static const char *perf_deny_globs[] = {
 
 /* fexit logical stack trace item */
 struct fstack_item {
-	const struct mass_attacher_func_info *finfo;
+	const struct func_meta *func;
 	int flags;
 	const char *name;
 	long res;
 	long lat;
+	long self_lat;
+	long offcpu_lat;
 	bool finished;
 	bool stitched;
 	bool err_start;
@@ -657,7 +841,6 @@ static bool is_err_in_mask(__u64 *err_mask, int err)
 
 static bool should_report_stack(struct ctx *ctx, const struct call_stack *s)
 {
-	struct retsnoop_bpf *skel = ctx->skel;
 	int i, id, flags, res;
 	bool allowed = false;
 
@@ -666,7 +849,7 @@ static bool should_report_stack(struct ctx *ctx, const struct call_stack *s)
 
 	for (i = 0; i < s->max_depth; i++) {
 		id = s->func_ids[i];
-		flags = skel->bss->func_flags[id];
+		flags = ctx->funcs[id].flags;
 
 		if (flags & FUNC_CANT_FAIL)
 			continue;
@@ -694,7 +877,7 @@ static bool should_report_stack(struct ctx *ctx, const struct call_stack *s)
 
 	for (i = s->saved_depth - 1; i < s->saved_max_depth; i++) {
 		id = s->saved_ids[i];
-		flags = skel->bss->func_flags[id];
+		flags = ctx->funcs[id].flags;
 
 		if (flags & FUNC_CANT_FAIL)
 			continue;
@@ -719,32 +902,33 @@ static bool should_report_stack(struct ctx *ctx, const struct call_stack *s)
 	return allowed;
 }
 
-static int filter_fstack(struct ctx *ctx, struct fstack_item *r, const struct call_stack *s)
+static int filter_fstack(struct ctx *ctx, struct fstack_item *r, const struct call_stack *s,
+			 const struct offcpu_stack *oc)
 {
-	const struct mass_attacher_func_info *finfo;
-	struct mass_attacher *att = ctx->att;
-	struct retsnoop_bpf *skel = ctx->skel;
+	const struct func_meta *func;
 	struct fstack_item *fitem;
-	const char *fname;
 	int i, id, flags, cnt;
 
 	for (i = 0, cnt = 0; i < s->max_depth; i++, cnt++) {
 		id = s->func_ids[i];
-		flags = skel->bss->func_flags[id];
-		finfo = mass_attacher__func(att, id);
-		fname = finfo->name;
+		func = &ctx->funcs[id];
+		flags = func->flags;
 
 		fitem = &r[cnt];
-		fitem->finfo = finfo;
+		fitem->func = func;
 		fitem->flags = flags;
-		fitem->name = fname;
+		fitem->name = func->name;
 		fitem->stitched = false;
 		if (i >= s->depth) {
 			fitem->finished = true;
 			fitem->lat = s->func_lat[i];
+			fitem->self_lat = s->func_self[i];
+			fitem->offcpu_lat = oc ? oc->func_offcpu[i] : 0;
 		} else {
 			fitem->finished = false;
 			fitem->lat = 0;
+			fitem->self_lat = 0;
+			fitem->offcpu_lat = 0;
 		}
 		if (flags & FUNC_NEEDS_SIGN_EXT)
 			fitem->res = (long)(int)s->func_res[i];
@@ -759,17 +943,18 @@ static int filter_fstack(struct ctx *ctx, struct fstack_item *r, const struct ca
 
 	for (i = s->saved_depth - 1; i < s->saved_max_depth; i++, cnt++) {
 		id = s->saved_ids[i];
-		flags = skel->bss->func_flags[id];
-		finfo = mass_attacher__func(att, id);
-		fname = finfo->name;
+		func = &ctx->funcs[id];
+		flags = func->flags;
 
 		fitem = &r[cnt];
-		fitem->finfo = finfo;
+		fitem->func = func;
 		fitem->flags = flags;
-		fitem->name = fname;
+		fitem->name = func->name;
 		fitem->stitched = true;
 		fitem->finished = true;
 		fitem->lat = s->saved_lat[i];
+		fitem->self_lat = s->saved_self[i];
+		fitem->offcpu_lat = oc ? oc->saved_offcpu[i] : 0;
 		if (flags & FUNC_NEEDS_SIGN_EXT)
 			fitem->res = (long)(int)s->saved_res[i];
 		else
@@ -945,14 +1130,18 @@ static int detect_linux_src_loc(const char *path)
  * !   0us [-ENOENT]    bpf_map_copy_value
  *
  */
+/* string stored in stack_items_cache's string arena */
+struct str_ref {
+	int off;
+	int len;
+};
+
 struct stack_item {
 	char marks[2]; /* spaces or '!' and/or '*' */
 
-	char dur[20+30];  /* duration, e.g. '11us' or '...' for incomplete stack */
-	int dur_len;   /* number of characters used for duration output */
-
-	char err[24];  /* returned error, e.g., '-ENOENT' or '...' for incomplete stack */
-	int err_len;   /* number of characters used for error output */
+	struct str_ref dur;  /* duration, e.g. '11us' or '...' for incomplete stack */
+	struct str_ref self; /* self duration, excluding time spent in callees */
+	struct str_ref err;  /* returned error, e.g., '-ENOENT' or '...' for incomplete stack */
 
 	/* resolved symbol name, but also can include:
 	 *   - full captured address, if --full-stacks option is enabled;
@@ -963,8 +1152,7 @@ struct stack_item {
 	 *   - '__x64_sys_bpf+0x1c';
 	 *   - '. map_lookup_elem'.
 	 */
-	char sym[124];
-	int sym_len;
+	struct str_ref sym;
 
 	/* source code location of resolved function, e.g.:
 	 *   - 'kernel/bpf/syscall.c:4749:1';
@@ -973,8 +1161,7 @@ struct stack_item {
 	 * match resolved kernel symbol, e.g.:
 	 *   'my_actual_func @ arch/x86/entry/entry_64.S:112:0'.
 	 */
-	char src[252];
-	int src_len;
+	struct str_ref src;
 };
 
 struct stack_items_cache
@@ -982,6 +1169,11 @@ struct stack_items_cache
 	struct stack_item *items;
 	size_t cnt;
 	size_t cap;
+
+	/* append-only arena for all strings of items, reset for each stack */
+	char *strs;
+	size_t strs_len;
+	size_t strs_cap;
 };
 
 static struct stack_items_cache stack_items1, stack_items2;
@@ -1002,23 +1194,87 @@ static struct stack_item *get_stack_item(struct stack_items_cache *cache)
 			return NULL;
 
 		cache->items = tmp;
-		memset(cache->items + cache->cap, 0, (new_cap - cache->cap) * sizeof(*s));
 		cache->cap = new_cap;
 	}
 
 	s = &cache->items[cache->cnt++];
 
-	s->dur_len = s->err_len = s->sym_len = s->src_len = 0;
-	s->dur[0] = s->err[0] = s->sym[0] = s->src[0] = 0;
+	memset(s, 0, sizeof(*s));
 	s->marks[0] = s->marks[1] = ' ';
 
 	return s;
 }
 
-#define snappendf(dst, fmt, args...)							\
-	dst##_len += snprintf(dst + dst##_len,						\
-			      sizeof(dst) < dst##_len ? 0 : sizeof(dst) - dst##_len,	\
-			      fmt, ##args)
+static void reset_stack_items(struct stack_items_cache *cache)
+{
+	cache->cnt = 0;
+	cache->strs_len = 0;
+}
+
+static int reserve_stack_strs(struct stack_items_cache *cache, size_t len)
+{
+	size_t new_cap = cache->strs_cap;
+	void *tmp;
+
+	if (cache->strs_len + len < cache->strs_cap)
+		return 0;
+
+	while (new_cap <= cache->strs_len + len)
+		new_cap = new_cap ? new_cap * 2 : 16 * 1024;
+
+	tmp = realloc(cache->strs, new_cap);
+	if (!tmp)
+		return -ENOMEM;
+
+	cache->strs = tmp;
+	cache->strs_cap = new_cap;
+	return 0;
+}
+
+__attribute__((format(printf, 3, 4)))
+static void stack_item_appendf(struct stack_items_cache *cache, struct str_ref *ref,
+			       const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	/* string can be extended in place only if it's the last one in the
+	 * arena, otherwise move it to the end first, leaving old copy unused
+	 */
+	if (ref->len == 0) {
+		ref->off = cache->strs_len;
+	} else if (ref->off + ref->len != cache->strs_len) {
+		if (reserve_stack_strs(cache, ref->len))
+			return;
+		memcpy(cache->strs + cache->strs_len, cache->strs + ref->off, ref->len);
+		ref->off = cache->strs_len;
+		cache->strs_len += ref->len;
+	}
+
+	va_start(args, fmt);
+	n = vsnprintf(cache->strs + cache->strs_len, cache->strs_cap - cache->strs_len, fmt, args);
+	va_end(args);
+	if (n < 0)
+		return;
+
+	if (cache->strs_len + n >= cache->strs_cap) {
+		if (reserve_stack_strs(cache, n))
+			return;
+		va_start(args, fmt);
+		vsnprintf(cache->strs + cache->strs_len, cache->strs_cap - cache->strs_len, fmt, args);
+		va_end(args);
+	}
+
+	cache->strs_len += n;
+	ref->len += n;
+}
+
+static inline const char *stack_item_str(const struct stack_items_cache *cache, struct str_ref ref)
+{
+	return ref.len ? cache->strs + ref.off : "";
+}
+
+#define snappendf(cache, dst, fmt, args...) stack_item_appendf(cache, &(dst), fmt, ##args)
 
 struct func_trace_item {
 	long ts;
@@ -1027,17 +1283,49 @@ struct func_trace_item {
 	int depth; /* 1-based, negative means exit from function */
 	int seq_id;
 	long func_res;
+	long func_self_lat;
+	long func_offcpu_lat;
     //------新变量------
     struct flow_tuple flow_info;
     //------新变量------
 };
 
+/* Function trace items are stored in fixed-size chunks. Chunks of purged
+ * traces are recycled through a global free list, so appending an item is
+ * O(1) and normally doesn't allocate at all. Most traces are short, and each
+ * in-flight trace pins at least one chunk, so chunks are kept small.
+ */
+#define FT_CHUNK_SHIFT 5
+#define FT_CHUNK_SZ (1 << FT_CHUNK_SHIFT)
+#define FT_CHUNK_MASK (FT_CHUNK_SZ - 1)
+
+struct func_trace_chunk {
+	struct func_trace_chunk *next; /* free list link */
+	struct func_trace_item items[FT_CHUNK_SZ];
+};
+
 struct func_trace {
 	int pid;
 	int cnt;
-	struct func_trace_item *entries;
+	int chunk_cnt;
+	int chunk_cap;
+	/* ring of chunk_cap (power of 2) chunk pointers, starting at
+	 * chunk_head, so that dropping oldest chunk is O(1)
+	 */
+	int chunk_head;
+	struct func_trace_chunk **chunks;
+	/* LRU list of traces, ordered by last activity */
+	struct func_trace *lru_prev;
+	struct func_trace *lru_next;
 };
 
+static inline struct func_trace_item *ft_entry(const struct func_trace *ft, int i)
+{
+	int idx = (ft->chunk_head + (i >> FT_CHUNK_SHIFT)) & (ft->chunk_cap - 1);
+
+	return &ft->chunks[idx]->items[i & FT_CHUNK_MASK];
+}
+
 static struct hashmap *func_traces_hash;
 
 static size_t func_traces_hasher(const void *key, void *ctx)
@@ -1059,17 +1347,131 @@ static int init_func_traces(void)
 	return 0;
 }
 
+#define FT_STATS_PERIOD_NS (10 * 1000000000ULL)
+
+static struct func_trace_chunk *ft_free_chunks;
+static long ft_chunk_cnt; /* allocated chunks, both in use and free */
+
+/* Traces of exited threads, or threads whose call stack got out of sync
+ * with BPF side, are never completed and would otherwise stay around
+ * forever, so memory used by traces is bounded by env.ft_mem_limit and
+ * least recently active traces get evicted to stay within it.
+ */
+static struct func_trace *ft_lru_head, *ft_lru_tail;
+
+static struct func_trace_stats {
+	long evicted;    /* traces evicted due to memory limit */
+	long truncated;  /* single trace outgrew memory limit */
+	long incomplete; /* traces restarted without ever being emitted */
+} ft_stats, ft_stats_reported;
+
+static void ft_lru_unlink(struct func_trace *ft)
+{
+	if (ft->lru_prev)
+		ft->lru_prev->lru_next = ft->lru_next;
+	else if (ft_lru_head == ft)
+		ft_lru_head = ft->lru_next;
+	if (ft->lru_next)
+		ft->lru_next->lru_prev = ft->lru_prev;
+	else if (ft_lru_tail == ft)
+		ft_lru_tail = ft->lru_prev;
+	ft->lru_prev = ft->lru_next = NULL;
+}
+
+static void ft_lru_touch(struct func_trace *ft)
+{
+	if (ft_lru_tail == ft)
+		return;
+
+	ft_lru_unlink(ft);
+	ft->lru_prev = ft_lru_tail;
+	if (ft_lru_tail)
+		ft_lru_tail->lru_next = ft;
+	else
+		ft_lru_head = ft;
+	ft_lru_tail = ft;
+}
+
+/* return trace's chunks for reuse by other traces */
+static void release_ft_chunks(struct func_trace *ft)
+{
+	struct func_trace_chunk *c;
+	int i;
+
+	for (i = 0; i < ft->chunk_cnt; i++) {
+		c = ft->chunks[(ft->chunk_head + i) & (ft->chunk_cap - 1)];
+		c->next = ft_free_chunks;
+		ft_free_chunks = c;
+	}
+	ft->chunk_cnt = 0;
+	ft->chunk_head = 0;
+	ft->cnt = 0;
+}
+
+/* recycle trace's oldest chunk, keeping the rest of its records */
+static void drop_oldest_ft_chunk(struct func_trace *ft)
+{
+	struct func_trace_chunk *c = ft->chunks[ft->chunk_head];
+
+	c->next = ft_free_chunks;
+	ft_free_chunks = c;
+
+	ft->chunk_head = (ft->chunk_head + 1) & (ft->chunk_cap - 1);
+	ft->chunk_cnt--;
+	ft->cnt -= FT_CHUNK_SZ;
+}
+
 static void free_func_trace(struct func_trace *ft)
 {
 	if (!ft)
 		return;
 
-	free(ft->entries);
+	ft_lru_unlink(ft);
+	release_ft_chunks(ft);
+
+	free(ft->chunks);
 	free(ft);
 }
 
+static struct func_trace_chunk *alloc_ft_chunk(struct func_trace *cur)
+{
+	struct func_trace_chunk *c;
+	struct func_trace *victim;
+
+	while (!ft_free_chunks && (ft_chunk_cnt + 1) * sizeof(*c) > env.ft_mem_limit) {
+		victim = ft_lru_head;
+		if (!victim || victim == cur) {
+			/* current trace alone is over the limit, drop its
+			 * oldest chunk of records; they will be reported as
+			 * missing
+			 */
+			if (cur->chunk_cnt == 0)
+				break;
+			drop_oldest_ft_chunk(cur);
+			ft_stats.truncated++;
+			break;
+		}
+
+		hashmap__delete(func_traces_hash, (const void *)(uintptr_t)victim->pid, NULL, NULL);
+		free_func_trace(victim);
+		ft_stats.evicted++;
+	}
+
+	c = ft_free_chunks;
+	if (c) {
+		ft_free_chunks = c->next;
+		return c;
+	}
+
+	c = malloc(sizeof(*c));
+	if (c)
+		ft_chunk_cnt++;
+	return c;
+}
+
 static void free_func_traces(void)
 {
+	struct func_trace_chunk *c;
 	struct hashmap_entry *e;
 	int bkt;
 
@@ -1081,6 +1483,27 @@ static void free_func_traces(void)
 	}
 
 	hashmap__free(func_traces_hash);
+
+	while ((c = ft_free_chunks)) {
+		ft_free_chunks = c->next;
+		free(c);
+	}
+}
+
+/* Report function trace eviction stats, if anything changed since last time */
+static void report_func_trace_stats(void)
+{
+	if (!func_traces_hash)
+		return;
+
+	if (memcmp(&ft_stats, &ft_stats_reported, sizeof(ft_stats)) == 0)
+		return;
+
+	fprintf(stderr, "Function traces: %zu in flight (%ld KB), %ld evicted, %ld truncated, %ld incomplete.\n",
+		hashmap__size(func_traces_hash), ft_chunk_cnt * sizeof(struct func_trace_chunk) / 1024,
+		ft_stats.evicted, ft_stats.truncated, ft_stats.incomplete);
+
+	ft_stats_reported = ft_stats;
 }
 
 static void purge_func_trace(struct ctx *ctx, int pid)
@@ -1095,8 +1518,72 @@ static void purge_func_trace(struct ctx *ctx, int pid)
 		free_func_trace(ft);
 }
 
+/* off-CPU times of call stacks about to be handled, keyed by pid */
+static struct hashmap *offcpu_stacks_hash;
+
+static int handle_offcpu_stack(struct ctx *ctx, const struct offcpu_stack *r)
+{
+	const void *k = (const void *)(uintptr_t)r->pid;
+	struct offcpu_stack *oc;
+
+	if (!offcpu_stacks_hash) {
+		offcpu_stacks_hash = hashmap__new(func_traces_hasher, func_traces_equal, NULL);
+		if (!offcpu_stacks_hash)
+			return -ENOMEM;
+	}
+
+	/* previous one, if any, was never followed by its call stack */
+	if (!hashmap__find(offcpu_stacks_hash, k, (void **)&oc)) {
+		oc = malloc(sizeof(*oc));
+		if (!oc || hashmap__add(offcpu_stacks_hash, k, oc)) {
+			free(oc);
+			return -ENOMEM;
+		}
+	}
+	*oc = *r;
+
+	return 0;
+}
+
+/* Take (and forget) off-CPU times emitted right before task's call stack.
+ * Returns false, if there are none. oc can be NULL to just drop them.
+ */
+static bool take_offcpu_stack(int pid, struct offcpu_stack *oc)
+{
+	const void *k = (const void *)(uintptr_t)pid;
+	struct offcpu_stack *tmp;
+
+	if (!offcpu_stacks_hash || !hashmap__delete(offcpu_stacks_hash, k, NULL, (void **)&tmp))
+		return false;
+
+	if (oc)
+		*oc = *tmp;
+	free(tmp);
+	return true;
+}
+
+static void free_offcpu_stacks(void)
+{
+	struct hashmap_entry *e;
+	size_t bkt;
+
+	if (!offcpu_stacks_hash)
+		return;
+
+	hashmap__for_each_entry(offcpu_stacks_hash, e, bkt)
+		free(e->value);
+	hashmap__free(offcpu_stacks_hash);
+}
+
 static int handle_func_trace_start(struct ctx *ctx, const struct func_trace_start *r)
 {
+	const void *k = (const void *)(uintptr_t)r->pid;
+	struct func_trace *ft;
+
+	/* previous trace of this thread never made it to output */
+	if (env.emit_func_trace && hashmap__find(func_traces_hash, k, (void **)&ft) && ft->cnt)
+		ft_stats.incomplete++;
+
 	purge_func_trace(ctx, r->pid);
 
 	return 0;
@@ -1107,7 +1594,9 @@ static int handle_func_trace_entry(struct ctx *ctx, const struct func_trace_entr
 	const void *k = (const void *)(uintptr_t)r->pid;
 	struct func_trace *ft;
 	struct func_trace_item *fti;
+	struct func_trace_chunk *c;
 	void *tmp;
+	int cap;
 
 	if (!hashmap__find(func_traces_hash, k, (void **)&ft)) {
 		ft = calloc(1, sizeof(*ft));
@@ -1119,18 +1608,38 @@ static int handle_func_trace_entry(struct ctx *ctx, const struct func_trace_entr
 		ft->pid = r->pid;
 	}
 
-	tmp = realloc(ft->entries, (ft->cnt + 1) * sizeof(ft->entries[0]));
-	if (!tmp)
-		return -ENOMEM;
-	ft->entries = tmp;
+	ft_lru_touch(ft);
 
-	fti = &ft->entries[ft->cnt];
+	if (ft->cnt == ft->chunk_cnt * FT_CHUNK_SZ) {
+		if (ft->chunk_cnt == ft->chunk_cap) {
+			cap = ft->chunk_cap ? ft->chunk_cap * 2 : 4;
+			tmp = realloc(ft->chunks, cap * sizeof(*ft->chunks));
+			if (!tmp)
+				return -ENOMEM;
+			ft->chunks = tmp;
+			/* full ring wraps around at chunk_head, move the wrapped
+			 * part right after the old end to keep it contiguous
+			 */
+			memcpy(ft->chunks + ft->chunk_cap, ft->chunks, ft->chunk_head * sizeof(*ft->chunks));
+			ft->chunk_cap = cap;
+		}
+
+		c = alloc_ft_chunk(ft);
+		if (!c)
+			return -ENOMEM;
+		ft->chunks[(ft->chunk_head + ft->chunk_cnt) & (ft->chunk_cap - 1)] = c;
+		ft->chunk_cnt++;
+	}
+
+	fti = ft_entry(ft, ft->cnt);
 	fti->ts = r->ts;
 	fti->func_id = r->func_id;
 	fti->depth = r->type == REC_FUNC_TRACE_ENTRY ? r->depth : -r->depth;
 	fti->seq_id = r->seq_id;
 	fti->func_lat = r->func_lat;
 	fti->func_res = r->func_res;
+	fti->func_self_lat = r->func_self_lat;
+	fti->func_offcpu_lat = r->func_offcpu_lat;
     fti->flow_info = r->flow_info;
 
 	ft->cnt++;
@@ -1138,7 +1647,8 @@ static int handle_func_trace_entry(struct ctx *ctx, const struct func_trace_entr
 	return 0;
 }
 
-static void prepare_func_res(struct stack_item *s, long res, int func_flags);
+static void prepare_func_res(struct stack_items_cache *cache, struct stack_item *s,
+			     long res, int func_flags);
 
 static char underline[512]; /* fill be filled with header underline char */
 static char spaces[512]; /* fill be filled with spaces */
@@ -1153,17 +1663,17 @@ static void add_missing_records_msg(struct stack_items_cache *cache, int miss_cn
 		return;
 	}
 
-	snappendf(s->src, "\u203C ... missing %d record%s ...",
+	snappendf(cache, s->src, "\u203C ... missing %d record%s ...",
 		  miss_cnt, miss_cnt == 1 ? "" : "s");
-	snappendf(s->dur, "...");
-	snappendf(s->err, "...");
+	snappendf(cache, s->dur, "...");
+	snappendf(cache, s->err, "...");
 }
 
 static void prepare_ft_items(struct ctx *ctx, struct stack_items_cache *cache,
 			     const struct call_stack *cs)
 {
 	const void *k = (const void *)(uintptr_t)cs->pid;
-	const struct mass_attacher_func_info *finfo;
+	const struct func_meta *func;
 	const char *sp, *mark;
 	struct stack_item *s;
 	struct func_trace *ft;
@@ -1173,11 +1683,11 @@ static void prepare_ft_items(struct ctx *ctx, struct stack_items_cache *cache,
 	if (!hashmap__find(func_traces_hash, k, (void **)&ft))
 		return;
 
-	cache->cnt = 0;
+	reset_stack_items(cache);
 
 	for (i = 0; i < ft->cnt; last_seq_id = f->seq_id, i++) {
-		f = &ft->entries[i];
-		finfo = mass_attacher__func(ctx->att, f->func_id);
+		f = ft_entry(ft, i);
+		func = &ctx->funcs[f->func_id];
 		d = f->depth > 0 ? f->depth : -f->depth;
         //缩进打印开关控制
 		sp = spaces + sizeof(spaces) - 1 - 4 * min(d - 1, 30);
@@ -1193,8 +1703,8 @@ static void prepare_ft_items(struct ctx *ctx, struct stack_items_cache *cache,
 		}
 
 		/* see if we can collapse leaf function entry/exit into one */
-		fn = &ft->entries[i + 1];
-		if (i + 1 < ft->cnt &&
+		fn = i + 1 < ft->cnt ? ft_entry(ft, i + 1) : NULL;
+		if (fn &&
 		    fn->seq_id == f->seq_id + 1 && /* consecutive items */
 		    fn->func_id == f->func_id && /* same function */
 		    f->depth > 0 && f->depth == -fn->depth /* matching entry and exit */) {
@@ -1212,15 +1722,20 @@ static void prepare_ft_items(struct ctx *ctx, struct stack_items_cache *cache,
 		/* store function name and space indentation in src, as we
 		 * might need a bunch of extra space due to deep nestedness
 		 */
-		snappendf(s->src, "%s%s%s~%d~", sp, mark, finfo->name,d);
+		snappendf(cache, s->src, "%s%s%s~%d~", sp, mark, func->name,d);
+		if (func->src)
+			snappendf(cache, s->src, "  (%s)", func->src);
 
         //depth < 0是函数退出时(kretprobe)，大于零是进入时(kprobe)
 		if (f->depth < 0) {
-			snappendf(s->dur, "~%.3fus", f->func_lat / 1000.0);
-			snappendf(s->dur, "<=%d-%d-%d-%d#",f->flow_info.saddr,f->flow_info.sport,f->flow_info.daddr,f->flow_info.dport);
-			prepare_func_res(s, f->func_res, ctx->skel->bss->func_flags[f->func_id]);
+			snappendf(cache, s->self, "%.3fus", f->func_self_lat / 1000.0);
+			snappendf(cache, s->dur, "~%.3fus", f->func_lat / 1000.0);
+			if (env.offcpu)
+				snappendf(cache, s->dur, "(off-CPU %.3fus)", f->func_offcpu_lat / 1000.0);
+			snappendf(cache, s->dur, "<=%d-%d-%d-%d#",f->flow_info.saddr,f->flow_info.sport,f->flow_info.daddr,f->flow_info.dport);
+			prepare_func_res(cache, s, f->func_res, func->flags);
 		}else if(f->depth > 0){
-            snappendf(s->dur, "=>%d-%d-%d-%d#",f->flow_info.saddr,f->flow_info.sport,f->flow_info.daddr,f->flow_info.dport);
+            snappendf(cache, s->dur, "=>%d-%d-%d-%d#",f->flow_info.saddr,f->flow_info.sport,f->flow_info.daddr,f->flow_info.dport);
         }
 	}
 
@@ -1232,46 +1747,51 @@ static void prepare_ft_items(struct ctx *ctx, struct stack_items_cache *cache,
 
 static void print_ft_items(struct ctx *ctx, const struct stack_items_cache *cache)
 {
-	int dur_len = 5, res_len = 0, src_len = 0, i;
+	int dur_len = 5, self_len = 0, res_len = 0, src_len = 0, i;
 	const struct stack_item *s;
 
-	printf("\n");
+	output__printf("\n");
 
 	/* calculate desired length of each auto-sized part of the output */
 	for (i = 0, s = cache->items; i < cache->cnt; i++, s++) {
-		dur_len = max(dur_len, s->dur_len);
-		res_len = max(res_len, s->err_len);
-		src_len = max(src_len, s->src_len);
+		dur_len = max(dur_len, s->dur.len);
+		self_len = max(self_len, s->self.len);
+		res_len = max(res_len, s->err.len);
+		src_len = max(src_len, s->src.len);
 	}
 	/* the whole +2 and -2 business is due to the use of unicode characters */
 	src_len = max(src_len, 2 + sizeof("FUNCTION CALL TRACE") - 1);
 	res_len = max(res_len, sizeof("RESULT") - 1);
+	self_len = max(self_len, sizeof("SELF") - 1);
 	dur_len = max(dur_len, sizeof("DURATION") - 1);
 
-	printf("%-*s   %-*s  %*s\n",
+	output__printf("%-*s   %-*s  %*s  %*s\n",
 	       src_len - 2, "FUNCTION CALL TRACE",
-	       res_len, "RESULT", dur_len, "DURATION");
-	printf("%-.*s   %-.*s  %.*s\n",
+	       res_len, "RESULT", self_len, "SELF", dur_len, "DURATION");
+	output__printf("%-.*s   %-.*s  %.*s  %.*s\n",
 	       src_len - 2, underline,
 	       res_len, underline,
+	       self_len, underline,
 	       dur_len, underline);
 
 	/* emit line by line taking into account calculated lengths of each column */
 	for (i = 0, s = cache->items; i < cache->cnt; i++, s++) {
-		printf("%-*s   %-*s  %*s\n",
-		       src_len, s->src,
-		       res_len, s->err,
-		       dur_len+30, s->dur);
+		output__printf("%-*.*s   %-*.*s  %*.*s  %*.*s\n",
+		       src_len, s->src.len, stack_item_str(cache, s->src),
+		       res_len, s->err.len, stack_item_str(cache, s->err),
+		       self_len, s->self.len, stack_item_str(cache, s->self),
+		       dur_len+30, s->dur.len, stack_item_str(cache, s->dur));
 	}
 
 }
 
-static void prepare_func_res(struct stack_item *s, long res, int func_flags)
+static void prepare_func_res(struct stack_items_cache *cache, struct stack_item *s,
+			     long res, int func_flags)
 {
 	const char *errstr;
 
 	if (func_flags & FUNC_RET_VOID) {
-		snappendf(s->err, "[void]");
+		snappendf(cache, s->err, "[void]");
 		return;
 	}
 
@@ -1280,45 +1800,64 @@ static void prepare_func_res(struct stack_item *s, long res, int func_flags)
 
 	if (res >= 0 || res < -MAX_ERRNO) {
 		if (func_flags & FUNC_RET_PTR)
-			snappendf(s->err, res == 0 ? "[NULL]" : "[%p]", (const void *)res);
+			snappendf(cache, s->err, res == 0 ? "[NULL]" : "[%p]", (const void *)res);
 		else if (func_flags & FUNC_RET_BOOL)
-			snappendf(s->err, res == 0 ? "[false]" : "[true]");
+			snappendf(cache, s->err, res == 0 ? "[false]" : "[true]");
 		else if (res >= -1024 * 1024 * 1024  && res < 1024 * 1024 /* random heuristic */)
-			snappendf(s->err, "[%ld]", res);
+			snappendf(cache, s->err, "[%ld]", res);
 		else
-			snappendf(s->err, "[0x%lx]", res);
+			snappendf(cache, s->err, "[0x%lx]", res);
 	} else {
 		errstr = err_to_str(res);
 		if (errstr)
-			snappendf(s->err, "[-%s]", errstr);
+			snappendf(cache, s->err, "[-%s]", errstr);
 		else
-			snappendf(s->err, "[%ld]", res);
+			snappendf(cache, s->err, "[%ld]", res);
 	}
 }
 
+static int symbolize_kstack_item(struct ctx *ctx, const struct kstack_item *kitem,
+				 struct a2l_resp *resps)
+{
+	long addr;
+	int cnt;
+
+	if (env.symb_mode == SYMB_NONE || !ctx->a2l || !kitem || kitem->filtered)
+		return 0;
+
+	addr = kitem->addr;
+	if (kitem->ksym && kitem->ksym->addr - kitem->addr == FTRACE_OFFSET)
+		addr -= FTRACE_OFFSET;
+
+	cnt = addr2line__symbolize(ctx->a2l, addr, resps);
+	return cnt < 0 ? 0 : cnt;
+}
+
+static const char *stack_item_func_name(const struct fstack_item *fitem,
+					const struct kstack_item *kitem)
+{
+	if (kitem && kitem->ksym)
+		return kitem->ksym->name;
+	if (fitem)
+		return fitem->name;
+	return "";
+}
+
 static void prepare_stack_items(struct ctx *ctx, const struct fstack_item *fitem,
 				const struct kstack_item *kitem)
 {
-	static struct a2l_resp resps[64];
+	static struct a2l_resp resps[A2L_MAX_FRAMES];
+	struct stack_items_cache *cache = &stack_items1;
 	struct a2l_resp *resp = NULL;
-	int symb_cnt = 0, i, line_off;
+	int symb_cnt, i, line_off;
 	const char *fname;
 	struct stack_item *s;
 
-	if (env.symb_mode != SYMB_NONE && ctx->a2l && kitem && !kitem->filtered) {
-		long addr = kitem->addr;
-
-		if (kitem->ksym && kitem->ksym && kitem->ksym->addr - kitem->addr == FTRACE_OFFSET)
-			addr -= FTRACE_OFFSET;
-
-		symb_cnt = addr2line__symbolize(ctx->a2l, addr, resps);
-		if (symb_cnt < 0)
-			symb_cnt = 0;
-		if (symb_cnt > 0)
-			resp = &resps[symb_cnt - 1];
-	}
+	symb_cnt = symbolize_kstack_item(ctx, kitem, resps);
+	if (symb_cnt > 0)
+		resp = &resps[symb_cnt - 1];
 
-	s = get_stack_item(&stack_items1);
+	s = get_stack_item(cache);
 	if (!s) {
 		fprintf(stderr, "Ran out of formatting space, some data will be omitted!\n");
 		return;
@@ -1329,41 +1868,47 @@ static void prepare_stack_items(struct ctx *ctx, const struct fstack_item *fitem
 	s->marks[1] = (fitem && fitem->stitched) ? '*' : ' ';
 
 	if (fitem && !fitem->finished) {
-		snappendf(s->dur, "...");
-		snappendf(s->err, "[...]");
+		snappendf(cache, s->dur, "...");
+		snappendf(cache, s->self, "(self ...)");
+		snappendf(cache, s->err, "[...]");
 	} else if (fitem) {
-		snappendf(s->dur, "%ldus", fitem->lat / 1000);
-		prepare_func_res(s, fitem->res, fitem->flags);
+		snappendf(cache, s->dur, "%ldus", fitem->lat / 1000);
+		if (env.offcpu)
+			snappendf(cache, s->self, "(self %ldus, off-CPU %ldus)",
+				  fitem->self_lat / 1000, fitem->offcpu_lat / 1000);
+		else
+			snappendf(cache, s->self, "(self %ldus)", fitem->self_lat / 1000);
+		prepare_func_res(cache, s, fitem->res, fitem->flags);
 	}
 
 	if (env.emit_full_stacks) {
 		if (kitem)
-			snappendf(s->sym, "%c%016lx ", kitem->filtered ? '~' : ' ',  kitem->addr);
+			snappendf(cache, s->sym, "%c%016lx ", kitem->filtered ? '~' : ' ',  kitem->addr);
 		else
-			snappendf(s->sym, " %*s ", 16, "");
+			snappendf(cache, s->sym, " %*s ", 16, "");
 	}
 
+	fname = stack_item_func_name(fitem, kitem);
+	snappendf(cache, s->sym, "%s", fname);
 	if (kitem && kitem->ksym)
-		fname = kitem->ksym->name;
-	else if (fitem)
-		fname = fitem->name;
-	else
-		fname = "";
-	snappendf(s->sym, "%s", fname);
-	if (kitem && kitem->ksym)
-		snappendf(s->sym, "+0x%lx", kitem->addr - kitem->ksym->addr);
-	if (symb_cnt) {
+		snappendf(cache, s->sym, "+0x%lx", kitem->addr - kitem->ksym->addr);
+	if (!kitem && fitem && fitem->func->src) {
+		/* no kernel stack frame to symbolize, but we still know
+		 * where the function itself is defined
+		 */
+		snappendf(cache, s->src, "(%s)", fitem->func->src);
+	} else if (symb_cnt) {
 		line_off = detect_linux_src_loc(resp->line);
 
-		snappendf(s->src, "(");
+		snappendf(cache, s->src, "(");
 		if (strcmp(fname, resp->fname) != 0)
-			snappendf(s->src, "%s @ ", resp->fname);
-		snappendf(s->src, "%s)", resp->line + line_off);
+			snappendf(cache, s->src, "%s @ ", resp->fname);
+		snappendf(cache, s->src, "%s)", resp->line + line_off);
 	}
 
 	/* append inlined calls */
 	for (i = 1, resp--; i < symb_cnt; i++, resp--) {
-		s = get_stack_item(&stack_items1);
+		s = get_stack_item(cache);
 		if (!s) {
 			fprintf(stderr, "Ran out of formatting space, some data will be omitted!\n");
 			return;
@@ -1371,39 +1916,43 @@ static void prepare_stack_items(struct ctx *ctx, const struct fstack_item *fitem
 
 		line_off = detect_linux_src_loc(resp->line);
 
-		snappendf(s->sym, "%*s. %s", env.emit_full_stacks ? 18 : 0, "", resp->fname);
-		snappendf(s->src, "(%s)", resp->line + line_off);
+		snappendf(cache, s->sym, "%*s. %s", env.emit_full_stacks ? 18 : 0, "", resp->fname);
+		snappendf(cache, s->src, "(%s)", resp->line + line_off);
 	}
 }
 
 static void print_stack_items(const struct stack_items_cache *cache)
 {
-	int dur_len = 5, err_len = 0, sym_len = 0, src_len = 0, i;
+	int dur_len = 5, self_len = 0, err_len = 0, sym_len = 0, src_len = 0, i;
 	const struct stack_item *s;
 
 	/* calculate desired length of each auto-sized part of the output */
 	for (i = 0, s = cache->items; i < cache->cnt; i++, s++) {
-		dur_len = max(dur_len, s->dur_len);
-		err_len = max(err_len, s->err_len);
-		sym_len = max(sym_len, s->sym_len);
-		src_len = max(src_len, s->src_len);
+		dur_len = max(dur_len, s->dur.len);
+		self_len = max(self_len, s->self.len);
+		err_len = max(err_len, s->err.len);
+		sym_len = max(sym_len, s->sym.len);
+		src_len = max(src_len, s->src.len);
 	}
 
-	printf("\n");
+	output__printf("\n");
 
 	/* emit line by line taking into account calculated lengths of each column */
 	for (i = 0, s = cache->items; i < cache->cnt; i++, s++) {
-		printf("%c%c %*s %-*s  %-*s  %-*s\n",
+		output__printf("%c%c %*.*s %-*.*s %-*.*s  %-*.*s  %-*.*s\n",
 		       s->marks[0], s->marks[1],
-		       dur_len, s->dur, err_len, s->err,
-		       sym_len, s->sym, src_len, s->src);
+		       dur_len, s->dur.len, stack_item_str(cache, s->dur),
+		       self_len, s->self.len, stack_item_str(cache, s->self),
+		       err_len, s->err.len, stack_item_str(cache, s->err),
+		       sym_len, s->sym.len, stack_item_str(cache, s->sym),
+		       src_len, s->src.len, stack_item_str(cache, s->src));
 	}
-    printf("-END-\n");
+    output__printf("-END-\n");
 }
 
 static void prepare_lbr_items(struct ctx *ctx, long addr, struct stack_items_cache *cache)
 {
-	static struct a2l_resp resps[64];
+	static struct a2l_resp resps[A2L_MAX_FRAMES];
 	struct a2l_resp *resp = NULL;
 	int symb_cnt = 0, line_off, i;
 	const struct ksym *ksym;
@@ -1416,11 +1965,11 @@ static void prepare_lbr_items(struct ctx *ctx, long addr, struct stack_items_cac
 	}
 
 	if (env.emit_full_stacks)
-		snappendf(s->sym, "%016lx ", addr);
+		snappendf(cache, s->sym, "%016lx ", addr);
 
 	ksym = ksyms__map_addr(ctx->ksyms, addr);
 	if (ksym)
-		snappendf(s->sym, "%s+0x%lx", ksym->name, addr - ksym->addr);
+		snappendf(cache, s->sym, "%s+0x%lx", ksym->name, addr - ksym->addr);
 
 	if (!ctx->a2l || env.symb_mode == SYMB_NONE)
 		return;
@@ -1432,10 +1981,10 @@ static void prepare_lbr_items(struct ctx *ctx, long addr, struct stack_items_cac
 	resp = &resps[symb_cnt - 1];
 	line_off = detect_linux_src_loc(resp->line);
 
-	snappendf(s->src, "(");
+	snappendf(cache, s->src, "(");
 	if (strcmp(ksym->name, resp->fname) != 0)
-		snappendf(s->src, "%s @ ", resp->fname);
-	snappendf(s->src, "%s)", resp->line + line_off);
+		snappendf(cache, s->src, "%s @ ", resp->fname);
+	snappendf(cache, s->src, "%s)", resp->line + line_off);
 
 	for (i = 1, resp--; i < symb_cnt; i++, resp--) {
 		line_off = detect_linux_src_loc(resp->line);
@@ -1446,9 +1995,9 @@ static void prepare_lbr_items(struct ctx *ctx, long addr, struct stack_items_cac
 			return;
 		}
 		if (env.emit_full_stacks)
-			snappendf(s->sym, "%*s ", 16, "");
-		snappendf(s->sym, ". %s", resp->fname);
-		snappendf(s->src, "(%s)", resp->line + line_off);
+			snappendf(cache, s->sym, "%*s ", 16, "");
+		snappendf(cache, s->sym, ". %s", resp->fname);
+		snappendf(cache, s->src, "(%s)", resp->line + line_off);
 	}
 }
 
@@ -1461,15 +2010,15 @@ static void print_lbr_items(int lbr_from, int lbr_to,
 
 	/* calculate desired length of each auto-sized part of the output */
 	for (i = 0, s1 = cache1->items; i < cache1->cnt; i++, s1++) {
-		sym_len1 = max(sym_len1, s1->sym_len);
-		src_len1 = max(src_len1, s1->src_len);
+		sym_len1 = max(sym_len1, s1->sym.len);
+		src_len1 = max(src_len1, s1->src.len);
 	}
 	for (j = 0, s2 = cache2->items; j < cache2->cnt; j++, s2++) {
-		sym_len2 = max(sym_len2, s2->sym_len);
-		src_len2 = max(src_len2, s2->src_len);
+		sym_len2 = max(sym_len2, s2->sym.len);
+		src_len2 = max(src_len2, s2->src.len);
 	}
 
-	printf("\n");
+	output__printf("\n");
 
 	/* emit each LBR record (which can contain multiple lines) */
 	for (i = 0, j = 0, k = lbr_from; k >= lbr_to; k--) {
@@ -1480,15 +2029,15 @@ static void print_lbr_items(int lbr_from, int lbr_to,
 			s2 = j < rec_cnts2[k] ? &cache2->items[j++] : NULL;
 
 			if (first)
-				printf("[#%02d] ", k);
+				output__printf("[#%02d] ", k);
 			else
-				printf("      ");
-			printf("%-*s %-*s  %s  %-*s %-*s\n",
-			       sym_len1, s1 ? s1->sym : "",
-			       src_len1, s1 ? s1->src : "",
+				output__printf("      ");
+			output__printf("%-*.*s %-*.*s  %s  %-*.*s %-*.*s\n",
+			       sym_len1, s1 ? s1->sym.len : 0, s1 ? stack_item_str(cache1, s1->sym) : "",
+			       src_len1, s1 ? s1->src.len : 0, s1 ? stack_item_str(cache1, s1->src) : "",
 			       first ? "->" : "  ",
-			       sym_len2, s2 ? s2->sym : "",
-			       src_len2, s2 ? s2->src : "");
+			       sym_len2, s2 ? s2->sym.len : 0, s2 ? stack_item_str(cache2, s2->sym) : "",
+			       src_len2, s2 ? s2->src.len : 0, s2 ? stack_item_str(cache2, s2->src) : "");
 
 			first = false;
 		}
@@ -1496,40 +2045,446 @@ static void print_lbr_items(int lbr_from, int lbr_to,
 }
 
 
-static bool lbr_matches(unsigned long addr, unsigned long start, unsigned long end)
+/*
+ * JSON Lines output. Each call stack, LBR block, and function call trace is
+ * emitted as a single-line JSON object as soon as it's processed, without
+ * the two-pass column layout of human-readable output.
+ */
+static void json_func_res(long res, int func_flags)
 {
-	if (!start)
-		return true;
+	const char *errstr;
 
-	return start <= addr && addr < end;
+	if (func_flags & FUNC_RET_VOID) {
+		output__printf(",\"res\":null");
+		return;
+	}
+
+	if (func_flags & FUNC_NEEDS_SIGN_EXT)
+		res = (long)(int)res;
+
+	if (func_flags & FUNC_RET_PTR)
+		output__printf(",\"res\":\"0x%lx\"", res);
+	else if (func_flags & FUNC_RET_BOOL)
+		output__printf(",\"res\":%s", res ? "true" : "false");
+	else
+		output__printf(",\"res\":%ld", res);
+
+	if (res < 0 && res >= -MAX_ERRNO) {
+		errstr = err_to_str(res);
+		if (errstr)
+			output__printf(",\"err\":\"-%s\"", errstr);
+	}
 }
 
-static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
+static void json_flow(const struct flow_tuple *flow)
 {
-	static struct fstack_item fstack[MAX_FSTACK_DEPTH];
-	static struct kstack_item kstack[MAX_KSTACK_DEPTH];
-	const struct fstack_item *fitem;
-	const struct kstack_item *kitem;
-	int i, j, fstack_n, kstack_n;
-	char ts2[64];
+	output__printf(",\"flow\":{\"saddr\":%u,\"sport\":%u,\"daddr\":%u,\"dport\":%u}",
+		       flow->saddr, flow->sport, flow->daddr, flow->dport);
+}
 
-	if (!s->is_err && !env.emit_success_stacks) {
-		purge_func_trace(dctx, s->pid);
-		return 0;
+/* emit source location of innermost symbolized frame, followed by inlined
+ * functions, from outermost to innermost
+ */
+static void json_src_locs(const char *fname, const struct a2l_resp *resps, int symb_cnt)
+{
+	const struct a2l_resp *resp = &resps[symb_cnt - 1];
+	int i;
+
+	output__printf(",\"src\":");
+	output__json_str(resp->line + detect_linux_src_loc(resp->line));
+	if (fname && strcmp(fname, resp->fname) != 0) {
+		output__printf(",\"src_func\":");
+		output__json_str(resp->fname);
 	}
 
-	if (s->is_err && env.has_error_filter && !should_report_stack(dctx, s)) {
+	if (symb_cnt < 2)
+		return;
+
+	output__printf(",\"inlined\":[");
+	for (i = 1, resp--; i < symb_cnt; i++, resp--) {
+		output__printf("%s{\"func\":", i == 1 ? "" : ",");
+		output__json_str(resp->fname);
+		output__printf(",\"src\":");
+		output__json_str(resp->line + detect_linux_src_loc(resp->line));
+		output__printf("}");
+	}
+	output__printf("]");
+}
+
+static void json_missing_records(int miss_cnt, bool first)
+{
+	output__printf("%s{\"ev\":\"missing\",\"count\":%d}", first ? "" : ",", miss_cnt);
+}
+
+static void json_ft_items(struct ctx *ctx, const struct call_stack *cs)
+{
+	const struct func_meta *func;
+	struct func_trace *ft;
+	struct func_trace_item *f, *fn;
+	const char *ev;
+	int i, d, last_seq_id = -1;
+	bool first = true;
+	long ts;
+
+	if (!hashmap__find(func_traces_hash, (const void *)(uintptr_t)cs->pid, (void **)&ft))
+		return;
+
+	output__printf("{\"type\":\"func_trace\",\"ts\":%llu,\"pid\":%d,\"tgid\":%d,\"events\":[",
+		       (unsigned long long)(cs->start_ts + ktime_off), cs->pid, cs->tgid);
+
+	for (i = 0; i < ft->cnt; last_seq_id = f->seq_id, i++) {
+		f = ft_entry(ft, i);
+		func = &ctx->funcs[f->func_id];
+		d = f->depth > 0 ? f->depth : -f->depth;
+		ts = f->ts;
+
+		if (f->seq_id > last_seq_id + 1) {
+			json_missing_records(f->seq_id - last_seq_id - 1, first);
+			first = false;
+		}
+
+		/* collapse leaf function entry/exit into one call event */
+		fn = i + 1 < ft->cnt ? ft_entry(ft, i + 1) : NULL;
+		if (fn &&
+		    fn->seq_id == f->seq_id + 1 &&
+		    fn->func_id == f->func_id &&
+		    f->depth > 0 && f->depth == -fn->depth) {
+			f = fn;
+			i += 1;
+		}
+
+		if (f == fn)
+			ev = "call";
+		else if (f->depth > 0)
+			ev = "entry";
+		else
+			ev = "exit";
+
+		output__printf("%s{\"ev\":\"%s\",\"ts\":%llu,\"depth\":%d,\"func\":",
+			       first ? "" : ",", ev, (unsigned long long)(ts + ktime_off), d);
+		output__json_str(func->name);
+		if (func->src) {
+			output__printf(",\"src\":");
+			output__json_str(func->src);
+		}
+		if (f->depth < 0) {
+			output__printf(",\"lat_ns\":%ld,\"self_ns\":%ld", f->func_lat, f->func_self_lat);
+			if (env.offcpu)
+				output__printf(",\"offcpu_ns\":%ld", f->func_offcpu_lat);
+			json_func_res(f->func_res, func->flags);
+		}
+		json_flow(&f->flow_info);
+		output__printf("}");
+		first = false;
+	}
+
+	if (cs->next_seq_id != last_seq_id + 1)
+		json_missing_records(cs->next_seq_id - last_seq_id - 1, first);
+
+	output__printf("]}\n");
+
+	purge_func_trace(ctx, ft->pid);
+}
+
+#define FOLDED_STACK_MAX_SZ (MAX_FSTACK_DEPTH * 128)
+
+/* join function names into a ';'-separated folded stack */
+static int fold_names(char *buf, size_t buf_sz, const char **names, int cnt)
+{
+	size_t len = 0;
+	int i, n;
+
+	for (i = 0; i < cnt; i++) {
+		n = snprintf(buf + len, buf_sz - len, "%s%s", i ? ";" : "", names[i] ?: "[missing]");
+		if (n >= buf_sz - len)
+			return -E2BIG;
+		len += n;
+	}
+	return 0;
+}
+
+static void fold_call_stack(struct ctx *ctx, const struct fstack_item *fstack, int fstack_n)
+{
+	static const char *names[MAX_FSTACK_DEPTH];
+	static char stack[FOLDED_STACK_MAX_SZ];
+	int i, err = 0;
+	long w;
+
+	for (i = 0; i < fstack_n; i++)
+		names[i] = fstack[i].name;
+
+	if (env.folded_weight == FOLDED_COUNT) {
+		err = fold_names(stack, sizeof(stack), names, fstack_n);
+		if (!err)
+			err = folded__add(ctx->folded, stack, 1);
+		goto out;
+	}
+
+	for (i = 0; i < fstack_n; i++) {
+		if (!fstack[i].finished)
+			continue;
+		w = fstack[i].self_lat;
+		if (w <= 0)
+			continue;
+
+		err = fold_names(stack, sizeof(stack), names, i + 1);
+		if (!err)
+			err = folded__add(ctx->folded, stack, w);
+		if (err)
+			break;
+	}
+out:
+	if (err)
+		fprintf(stderr, "Failed to aggregate folded call stack: %d\n", err);
+}
+
+static void fold_ft_items(struct ctx *ctx, const struct call_stack *cs)
+{
+	/* names of currently active functions, indexed by depth */
+	static const char *names[MAX_FSTACK_DEPTH + 1];
+	static char stack[FOLDED_STACK_MAX_SZ];
+	const struct func_trace_item *f;
+	struct func_trace *ft;
+	int i, d, err = 0;
+	long w;
+
+	if (!hashmap__find(func_traces_hash, (const void *)(uintptr_t)cs->pid, (void **)&ft))
+		return;
+
+	memset(names, 0, sizeof(names));
+	for (i = 0; i < ft->cnt; i++) {
+		f = ft_entry(ft, i);
+		d = f->depth > 0 ? f->depth : -f->depth;
+		if (d > MAX_FSTACK_DEPTH)
+			continue;
+
+		names[d] = ctx->funcs[f->func_id].name;
+		if (f->depth > 0)
+			continue;
+
+		w = env.folded_weight == FOLDED_COUNT ? 1 : f->func_self_lat;
+
+		if (w > 0) {
+			err = fold_names(stack, sizeof(stack), names + 1, d);
+			if (!err)
+				err = folded__add(ctx->folded, stack, w);
+			if (err)
+				break;
+		}
+
+		names[d] = NULL;
+	}
+
+	if (err)
+		fprintf(stderr, "Failed to aggregate folded function call trace: %d\n", err);
+}
+
+static void export_ft_items(struct ctx *ctx, const struct call_stack *cs)
+{
+	/* last seen entry at each depth, for pairing with exits */
+	static const struct func_trace_item *entries[MAX_FSTACK_DEPTH + 1];
+	const struct func_trace_item *f, *e;
+	struct trace_export_call call;
+	const struct func_meta *func;
+	struct func_trace *ft;
+	int i, d, err;
+
+	if (!hashmap__find(func_traces_hash, (const void *)(uintptr_t)cs->pid, (void **)&ft))
+		return;
+
+	err = trace_export__add_thread(ctx->te, cs->pid, cs->tgid, cs->task_comm, cs->proc_comm);
+	if (err)
+		goto err_out;
+
+	memset(entries, 0, sizeof(entries));
+	for (i = 0; i < ft->cnt; i++) {
+		f = ft_entry(ft, i);
+		d = f->depth > 0 ? f->depth : -f->depth;
+		if (d > MAX_FSTACK_DEPTH)
+			continue;
+
+		if (f->depth > 0) {
+			entries[d] = f;
+			continue;
+		}
+
+		/* entry record might have been lost, in which case start of
+		 * the call is derived from its latency
+		 */
+		e = entries[d];
+		if (e && e->func_id != f->func_id)
+			e = NULL;
+		entries[d] = NULL;
+
+		func = &ctx->funcs[f->func_id];
+		call.name = func->name;
+		call.ts = e ? e->ts : f->ts - f->func_lat;
+		call.dur = f->func_lat;
+		call.depth = d;
+		call.has_res = !(func->flags & FUNC_RET_VOID);
+		call.res = (func->flags & FUNC_NEEDS_SIGN_EXT) ? (long)(int)f->func_res : f->func_res;
+		call.entry_flow = e ? &e->flow_info : NULL;
+		call.exit_flow = &f->flow_info;
+
+		err = trace_export__add_call(ctx->te, cs->pid, cs->tgid, &call);
+		if (err)
+			goto err_out;
+	}
+	return;
+
+err_out:
+	fprintf(stderr, "Failed to export function call trace for PID %d: %d\n", cs->pid, err);
+}
+
+static void json_stack_item(struct ctx *ctx, const struct fstack_item *fitem,
+			    const struct kstack_item *kitem, int idx)
+{
+	static struct a2l_resp resps[A2L_MAX_FRAMES];
+	const char *fname;
+	int symb_cnt;
+
+	symb_cnt = symbolize_kstack_item(ctx, kitem, resps);
+	fname = stack_item_func_name(fitem, kitem);
+
+	output__printf("%s{\"func\":", idx ? "," : "");
+	output__json_str(fname);
+	output__printf(",\"traced\":%s", fitem ? "true" : "false");
+
+	/* kitem == NULL should be rare, either a bug or we couldn't get valid kernel stack trace */
+	if (kitem) {
+		output__printf(",\"addr\":\"0x%lx\"", kitem->addr);
+		if (kitem->ksym)
+			output__printf(",\"off\":\"0x%lx\"", kitem->addr - kitem->ksym->addr);
+		if (kitem->filtered)
+			output__printf(",\"filtered\":true");
+	} else {
+		output__printf(",\"no_kstack\":true");
+	}
+
+	if (fitem && fitem->stitched)
+		output__printf(",\"stitched\":true");
+	if (fitem && !fitem->finished) {
+		output__printf(",\"finished\":false");
+	} else if (fitem) {
+		output__printf(",\"lat_ns\":%ld,\"self_ns\":%ld", fitem->lat, fitem->self_lat);
+		if (env.offcpu)
+			output__printf(",\"offcpu_ns\":%ld", fitem->offcpu_lat);
+		json_func_res(fitem->res, fitem->flags);
+	}
+
+	if (!kitem && fitem && fitem->func->src) {
+		output__printf(",\"src\":");
+		output__json_str(fitem->func->src);
+	} else if (symb_cnt) {
+		json_src_locs(fname, resps, symb_cnt);
+	}
+
+	output__printf("}");
+}
+
+static void json_lbr_addr(struct ctx *ctx, long addr)
+{
+	static struct a2l_resp resps[A2L_MAX_FRAMES];
+	const struct ksym *ksym;
+	int symb_cnt = 0;
+
+	output__printf("{\"addr\":\"0x%lx\"", addr);
+
+	ksym = ksyms__map_addr(ctx->ksyms, addr);
+	if (ksym) {
+		output__printf(",\"func\":");
+		output__json_str(ksym->name);
+		output__printf(",\"off\":\"0x%lx\"", addr - ksym->addr);
+	}
+
+	if (ctx->a2l && env.symb_mode != SYMB_NONE)
+		symb_cnt = addr2line__symbolize(ctx->a2l, addr, resps);
+	if (symb_cnt > 0)
+		json_src_locs(ksym ? ksym->name : NULL, resps, symb_cnt);
+
+	output__printf("}");
+}
+
+static void json_lbr_items(struct ctx *ctx, const struct call_stack *s,
+			   int lbr_from, int lbr_to, bool filtered)
+{
+	int k;
+
+	output__printf("{\"type\":\"lbr\",\"ts\":%llu,\"pid\":%d,\"tgid\":%d,\"filtered\":%s,\"records\":[",
+		       (unsigned long long)(s->start_ts + ktime_off), s->pid, s->tgid,
+		       filtered ? "true" : "false");
+
+	for (k = lbr_from; k >= lbr_to; k--) {
+		output__printf("%s{\"idx\":%d,\"from\":", k == lbr_from ? "" : ",", k);
+		json_lbr_addr(ctx, s->lbrs[k].from);
+		output__printf(",\"to\":");
+		json_lbr_addr(ctx, s->lbrs[k].to);
+		output__printf("}");
+	}
+
+	output__printf("]}\n");
+}
+
+static void json_stack_start(const struct call_stack *s)
+{
+	output__printf("{\"type\":\"stack\",\"ts\":%llu,\"emit_ts\":%llu,\"pid\":%d,\"tgid\":%d,\"comm\":",
+		       (unsigned long long)(s->start_ts + ktime_off),
+		       (unsigned long long)(s->emit_ts + ktime_off),
+		       s->pid, s->tgid);
+	output__json_str(s->task_comm);
+	output__printf(",\"proc_comm\":");
+	output__json_str(s->proc_comm);
+	output__printf(",\"is_err\":%s,\"frames\":[", s->is_err ? "true" : "false");
+}
+
+static void emit_stack_item(struct ctx *ctx, const struct fstack_item *fitem,
+			    const struct kstack_item *kitem, int idx)
+{
+	if (env.json)
+		json_stack_item(ctx, fitem, kitem, idx);
+	else
+		prepare_stack_items(ctx, fitem, kitem);
+}
+
+static bool lbr_matches(unsigned long addr, unsigned long start, unsigned long end)
+{
+	if (!start)
+		return true;
+
+	return start <= addr && addr < end;
+}
+
+static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
+{
+	static struct fstack_item fstack[MAX_FSTACK_DEPTH];
+	static struct kstack_item kstack[MAX_KSTACK_DEPTH];
+	static struct offcpu_stack oc_buf;
+	const struct offcpu_stack *oc;
+	const struct fstack_item *fitem;
+	const struct kstack_item *kitem;
+	int i, j, n, fstack_n, kstack_n;
+	char ts2[64];
+
+	/* consume off-CPU times even if call stack itself is filtered out */
+	oc = take_offcpu_stack(s->pid, &oc_buf) ? &oc_buf : NULL;
+
+	if (!s->is_err && !env.emit_success_stacks) {
 		purge_func_trace(dctx, s->pid);
 		return 0;
 	}
 
-	if (env.debug) {
-		printf("GOT %s STACK (depth %u):\n", s->is_err ? "ERROR" : "SUCCESS", s->max_depth);
-		printf("DEPTH %d MAX DEPTH %d SAVED DEPTH %d MAX SAVED DEPTH %d\n",
+	if (s->is_err && env.has_error_filter && !should_report_stack(dctx, s)) {
+		purge_func_trace(dctx, s->pid);
+		return 0;
+	}
+
+	if (env.debug && !env.json) {
+		output__printf("GOT %s STACK (depth %u):\n", s->is_err ? "ERROR" : "SUCCESS", s->max_depth);
+		output__printf("DEPTH %d MAX DEPTH %d SAVED DEPTH %d MAX SAVED DEPTH %d\n",
 				s->depth, s->max_depth, s->saved_depth, s->saved_max_depth);
 	}
 
-	fstack_n = filter_fstack(dctx, fstack, s);
+	fstack_n = filter_fstack(dctx, fstack, s, oc);
 	if (fstack_n < 0) {
 		fprintf(stderr, "FAILURE DURING FILTERING FUNCTION STACK!!! %d\n", fstack_n);
 		purge_func_trace(dctx, s->pid);
@@ -1541,27 +2496,42 @@ static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
 		purge_func_trace(dctx, s->pid);
 		return -1;
 	}
-	if (env.debug) {
-		printf("FSTACK (%d items):\n", fstack_n);
-		printf("KSTACK (%d items out of original %ld):\n", kstack_n, s->kstack_sz / 8);
+	if (env.debug && !env.json) {
+		output__printf("FSTACK (%d items):\n", fstack_n);
+		output__printf("KSTACK (%d items out of original %ld):\n", kstack_n, s->kstack_sz / 8);
 	}
     char t11[256];
     sprintf(t11, "%lld", s->start_ts + ktime_off);
 	// ts_to_str(s->start_ts + ktime_off, ts1, sizeof(ts1));
 	ts_to_str(s->emit_ts + ktime_off, ts2, sizeof(ts2));
-	printf("%s -> %s TID/PID %d/%d (%s/%s):\n", t11, ts2, s->pid, s->tgid,  s->task_comm, s->proc_comm);
+	if (!env.json)
+		output__printf("%s -> %s TID/PID %d/%d (%s/%s):\n", t11, ts2, s->pid, s->tgid,  s->task_comm, s->proc_comm);
 
 	/* Emit more verbose outputs before more succinct and high signal output.
 	 * Func trace goes first, then LBR, then (error) stack trace, each
 	 * conditional on being enabled to be collected and output
 	 */
 
+	/* Aggregate func trace paths, if captured, or just the call stack */
+	if (dctx->folded) {
+		if (!env.emit_func_trace)
+			fold_call_stack(dctx, fstack, fstack_n);
+		else if (s->depth == 0)
+			fold_ft_items(dctx, s);
+	}
+
 	/* Emit detailed function calls trace, but only if we have completed
 	 * call stack trace (depth == 0)
 	 */
 	if (env.emit_func_trace && s->depth == 0) {
-		prepare_ft_items(dctx, &stack_items1, s);
-		print_ft_items(dctx, &stack_items1);
+		if (dctx->te)
+			export_ft_items(dctx, s);
+		if (env.json) {
+			json_ft_items(dctx, s);
+		} else {
+			prepare_ft_items(dctx, &stack_items1, s);
+			print_ft_items(dctx, &stack_items1);
+		}
 	}
 
 	/* LBR output */
@@ -1579,9 +2549,9 @@ static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
 
 		if (fstack_n > 0) {
 			fitem = &fstack[fstack_n - 1];
-			if (fitem->finfo->size) {
-				start = fitem->finfo->addr;
-				end = fitem->finfo->addr + fitem->finfo->size;
+			if (fitem->func->size) {
+				start = fitem->func->addr;
+				end = fitem->func->addr + fitem->func->size;
 			}
 		}
 
@@ -1609,8 +2579,14 @@ static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
 		if (env.lbr_max_cnt && lbr_from - lbr_to + 1 > env.lbr_max_cnt)
 			lbr_from = min(lbr_cnt - 1, lbr_to + env.lbr_max_cnt - 1);
 
-		stack_items1.cnt = 0;
-		stack_items2.cnt = 0;
+		if (env.json) {
+			json_lbr_items(dctx, s, lbr_from, lbr_to,
+				       !env.emit_full_stacks && found_useful_lbrs);
+			goto emit_stack;
+		}
+
+		reset_stack_items(&stack_items1);
+		reset_stack_items(&stack_items2);
 		for (i = lbr_from; i >= lbr_to; i--) {
 			prepare_lbr_items(dctx, s->lbrs[i].from, &stack_items1);
 			prepare_lbr_items(dctx, s->lbrs[i].to, &stack_items2);
@@ -1624,14 +2600,18 @@ static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
 				&stack_items2, rec_cnts2);
 
 		if (!env.emit_full_stacks && !found_useful_lbrs)
-			printf("[LBR] No relevant LBR data were captured, showing unfiltered LBR stack!\n");
+			output__printf("[LBR] No relevant LBR data were captured, showing unfiltered LBR stack!\n");
 	}
 
+emit_stack:
 	/* Emit combined fstack/kstack + errors stack trace */
-	stack_items1.cnt = 0;
+	reset_stack_items(&stack_items1);
+	if (env.json)
+		json_stack_start(s);
 
 	i = 0;
 	j = 0;
+	n = 0;
 	while (i < fstack_n) {
 		fitem = &fstack[i];
 		kitem = j < kstack_n ? &kstack[j] : NULL;
@@ -1640,7 +2620,7 @@ static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
 			/* this shouldn't happen unless we got no kernel stack
 			 * or there is some bug
 			 */
-			prepare_stack_items(dctx, fitem, NULL);
+			emit_stack_item(dctx, fitem, NULL, n++);
 			i++;
 			continue;
 		}
@@ -1651,34 +2631,47 @@ static int handle_call_stack(struct ctx *dctx, const struct call_stack *s)
 		 */
 		if (!kitem->ksym || kitem->filtered
 		    || strcmp(kitem->ksym->name, fitem->name) != 0) {
-			prepare_stack_items(dctx, NULL, kitem);
+			emit_stack_item(dctx, NULL, kitem, n++);
 			j++;
 			continue;
 		}
 
 		/* happy case, lots of info, yay */
-		prepare_stack_items(dctx, fitem, kitem);
+		emit_stack_item(dctx, fitem, kitem, n++);
 		i++;
 		j++;
 		continue;
 	}
 
 	for (; j < kstack_n; j++) {
-		prepare_stack_items(dctx, NULL, &kstack[j]);
+		emit_stack_item(dctx, NULL, &kstack[j], n++);
+	}
+
+	if (env.json) {
+		output__printf("]}\n");
+		output__end_record();
+		return 0;
 	}
 
 	print_stack_items(&stack_items1);
 
 out:
-	printf("\n\n");
+	if (!env.json)
+		output__printf("\n\n");
+	output__end_record();
 
 	return 0;
 }
 
 static int handle_event(void *ctx, void *data, size_t data_sz)
 {
+	struct recorder *rec = ((struct ctx *)ctx)->rec;
 	enum rec_type type = *(enum rec_type *)data;
 
+	/* all the processing is deferred until replay */
+	if (rec)
+		return recorder__write(rec, data, data_sz);
+
 	switch (type) {
 	case REC_CALL_STACK:
 		return handle_call_stack(ctx, data);
@@ -1687,6 +2680,8 @@ static int handle_event(void *ctx, void *data, size_t data_sz)
 	case REC_FUNC_TRACE_ENTRY:
 	case REC_FUNC_TRACE_EXIT:
 		return handle_func_trace_entry(ctx, data);
+	case REC_OFFCPU_STACK:
+		return handle_offcpu_stack(ctx, data);
 	default:
 		fprintf(stderr, "Unrecognized record type %d\n", type);
 		return -ENOTSUP;
@@ -1746,6 +2741,47 @@ static int func_flags(const char *func_name, const struct btf *btf, int btf_id)
 	return 0;
 }
 
+static void symbolize_func_cb(int idx, const struct a2l_resp *resps, int resp_cnt, void *ctx)
+{
+	struct func_meta *func = &((struct ctx *)ctx)->funcs[idx];
+	const struct a2l_resp *resp;
+	char buf[sizeof(resp->fname) + sizeof(resp->line) + 3];
+	int line_off;
+
+	if (resp_cnt <= 0)
+		return;
+
+	/* outermost frame corresponds to the function itself */
+	resp = &resps[resp_cnt - 1];
+	line_off = detect_linux_src_loc(resp->line);
+
+	if (strcmp(func->name, resp->fname) != 0)
+		snprintf(buf, sizeof(buf), "%s @ %s", resp->fname, resp->line + line_off);
+	else
+		snprintf(buf, sizeof(buf), "%s", resp->line + line_off);
+
+	func->src = strdup(buf);
+}
+
+/* Resolve source code locations of all traced functions in one batch */
+static int symbolize_funcs(struct ctx *ctx)
+{
+	long *addrs;
+	int i, err;
+
+	addrs = calloc(ctx->func_cnt, sizeof(*addrs));
+	if (!addrs)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->func_cnt; i++)
+		addrs[i] = ctx->funcs[i].addr;
+
+	err = addr2line__symbolize_batch(ctx->a2l, addrs, ctx->func_cnt, symbolize_func_cb, ctx);
+
+	free(addrs);
+	return err;
+}
+
 static bool func_filter(const struct mass_attacher *att,
 			const struct btf *btf, int func_btf_id,
 			const char *name, int func_id)
@@ -1754,6 +2790,34 @@ static bool func_filter(const struct mass_attacher *att,
 	return true;
 }
 
+/* Make sure vmlinux image used for symbolization matches recorded kernel */
+static int check_replay_build_id(struct replayer *rp, const char *vmlinux)
+{
+	const struct record_hdr *hdr = replayer__hdr(rp);
+	unsigned char build_id[BUILD_ID_MAX_SZ];
+	int sz;
+
+	/* build ID of recorded kernel is unknown, nothing to check */
+	if (hdr->build_id_sz == 0)
+		return 0;
+
+	sz = elf_build_id(vmlinux, build_id, sizeof(build_id));
+	if (sz < 0) {
+		fprintf(stderr, "Failed to determine build ID of vmlinux image at %s, ignoring: %d\n",
+			vmlinux, sz);
+		return 0;
+	}
+
+	if (sz != hdr->build_id_sz || memcmp(build_id, hdr->build_id, sz) != 0) {
+		fprintf(stderr, "%s: build ID of vmlinux image at %s doesn't match recorded kernel%s\n",
+			env.vmlinux_path ? "Error" : "Warning", vmlinux,
+			env.vmlinux_path ? "" : ", source code locations will be wrong");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int find_vmlinux(char *path, size_t max_len, bool soft)
 {
 	const char *locations[] = {
@@ -1795,59 +2859,44 @@ static int find_vmlinux(char *path, size_t max_len, bool soft)
 
 static int detect_kernel_features(void)
 {
-	struct calib_feat_bpf *skel;
+	struct kernel_features feats;
 	int err;
 
-	skel = calib_feat_bpf__open_and_load();
-	if (!skel) {
-		err = -errno;
-		fprintf(stderr, "Failed to load feature detection skeleton.\n");
-		return err;
-	}
-
-	if (!skel->bss) {
-		fprintf(stderr, "Kernel doesn't support memory mapping BPF global vars, you might need newer Linux kernel.\n");
-		err = -EOPNOTSUPP;
-		goto out;
-	}
-
-	skel->bss->my_tid = syscall(SYS_gettid);
-
-	err = calib_feat_bpf__attach(skel);
+	err = kernel_features__get(&feats, env.recalibrate);
 	if (err) {
-		fprintf(stderr, "Failed to attach feature detection skeleton.\n");
-		goto out;
+		fprintf(stderr, "Failed to detect kernel features: %d\n", err);
+		return err;
 	}
 
-	usleep(1);
-
 	if (env.debug) {
-		printf("Feature detection:\n"
+		printf("Feature detection%s:\n"
 		       "\tBPF ringbuf map supported: %s\n"
 		       "\tbpf_get_func_ip() supported: %s\n"
 		       "\tbpf_get_branch_snapshot() supported: %s\n"
 		       "\tBPF cookie supported: %s\n"
-		       "\tmulti-attach kprobe supported: %s\n",
-		       skel->bss->has_ringbuf ? "yes" : "no",
-		       skel->bss->has_bpf_get_func_ip ? "yes" : "no",
-		       skel->bss->has_branch_snapshot ? "yes" : "no",
-		       skel->bss->has_bpf_cookie ? "yes" : "no",
-		       skel->bss->has_kprobe_multi ? "yes" : "no");
+		       "\tmulti-attach kprobe supported: %s\n"
+		       "\tbpf_get_current_ancestor_cgroup_id() supported: %s\n",
+		       feats.cached ? " (cached, use --recalibrate to redo)" : "",
+		       feats.has_ringbuf ? "yes" : "no",
+		       feats.has_bpf_get_func_ip ? "yes" : "no",
+		       feats.has_branch_snapshot ? "yes" : "no",
+		       feats.has_bpf_cookie ? "yes" : "no",
+		       feats.has_kprobe_multi ? "yes" : "no",
+		       feats.has_ancestor_cgroup_id ? "yes" : "no");
 		printf("Feature calibration:\n"
 		       "\tkretprobe IP offset: %d\n"
 		       "\tfexit sleep fix: %s\n"
 		       "\tfentry re-entry protection: %s\n",
-		       skel->bss->kret_ip_off,
-		       skel->bss->has_fexit_sleep_fix ? "yes" : "no",
-		       skel->bss->has_fentry_protection ? "yes" : "no");
+		       feats.kret_ip_off,
+		       feats.has_fexit_sleep_fix ? "yes" : "no",
+		       feats.has_fentry_protection ? "yes" : "no");
 	}
 
-	env.has_ringbuf = skel->bss->has_ringbuf;
-	env.has_branch_snapshot = skel->bss->has_branch_snapshot;
+	env.has_ringbuf = feats.has_ringbuf;
+	env.has_branch_snapshot = feats.has_branch_snapshot;
+	env.has_ancestor_cgroup_id = feats.has_ancestor_cgroup_id;
 
-out:
-	calib_feat_bpf__destroy(skel);
-	return err;
+	return 0;
 }
 
 #define INTEL_FIXED_VLBR_EVENT        0x1b00
@@ -1902,6 +2951,119 @@ static void sig_handler(int sig)
 	exiting = true;
 }
 
+static bool str_in_list(const char *str, char **strs, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (strncmp(str, strs[i], TASK_COMM_LEN - 1) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool pid_in_list(int pid, const int *pids, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (pids[i] == pid)
+			return true;
+	}
+	return false;
+}
+
+/* Userspace equivalent of BPF-side PID, COMM, and duration filtering, done
+ * during replay. Denylists override allowlists, same as on BPF side.
+ */
+static bool replay_stack_allowed(const struct call_stack *s)
+{
+	if (env.pid && s->tgid != env.pid)
+		return false;
+
+	if (pid_in_list(s->tgid, env.deny_pids, env.deny_pid_cnt))
+		return false;
+	if (env.allow_pid_cnt && !pid_in_list(s->tgid, env.allow_pids, env.allow_pid_cnt))
+		return false;
+
+	if (str_in_list(s->task_comm, env.deny_comms, env.deny_comm_cnt))
+		return false;
+	if (env.allow_comm_cnt && !str_in_list(s->task_comm, env.allow_comms, env.allow_comm_cnt))
+		return false;
+
+	if (env.longer_than_ms && s->emit_ts - s->start_ts < env.longer_than_ms * 1000000LL)
+		return false;
+
+	return true;
+}
+
+/* Feed events from recording through the same pipeline as live events */
+static int replay_events(struct ctx *ctx, struct replayer *rp)
+{
+	const struct replay_func *funcs;
+	const struct call_stack *s;
+	enum rec_type type;
+	size_t data_sz, rec_cnt = 0;
+	void *data;
+	int i, n, err;
+
+	funcs = replayer__funcs(rp, &n);
+	ctx->funcs = calloc(n, sizeof(*ctx->funcs));
+	if (!ctx->funcs && n)
+		return -ENOMEM;
+	ctx->func_cnt = n;
+
+	for (i = 0; i < n; i++) {
+		ctx->funcs[i].name = funcs[i].name;
+		ctx->funcs[i].module = funcs[i].module;
+		ctx->funcs[i].addr = funcs[i].addr;
+		ctx->funcs[i].size = funcs[i].size;
+		ctx->funcs[i].flags = funcs[i].flags;
+	}
+
+	if (ctx->a2l && env.symb_mode != SYMB_NONE) {
+		err = symbolize_funcs(ctx);
+		if (err)
+			fprintf(stderr, "Failed to symbolize traced functions, ignoring: %d\n", err);
+	}
+
+	err = init_func_traces();
+	if (err) {
+		fprintf(stderr, "Failed to initialize func traces state: %d\n", err);
+		return err;
+	}
+
+	while (!exiting && (err = replayer__next(rp, &data, &data_sz)) > 0) {
+		type = *(enum rec_type *)data;
+		if ((type == REC_FUNC_TRACE_ENTRY || type == REC_FUNC_TRACE_EXIT) && !env.emit_func_trace)
+			continue;
+		if (type == REC_CALL_STACK) {
+			s = data;
+			if (!replay_stack_allowed(s)) {
+				purge_func_trace(ctx, s->pid);
+				take_offcpu_stack(s->pid, NULL);
+				continue;
+			}
+		}
+
+		err = handle_event(ctx, data, data_sz);
+		if (err)
+			return err;
+		rec_cnt++;
+	}
+	if (err < 0) {
+		fprintf(stderr, "Failed to read recording: %d\n", err);
+		return err;
+	}
+
+	output__flush(true);
+	report_func_trace_stats();
+	if (env.verbose)
+		printf("Replayed %zu events.\n", rec_cnt);
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	long page_size = sysconf(_SC_PAGESIZE);
@@ -1912,11 +3074,14 @@ int main(int argc, char **argv)
 	struct retsnoop_bpf *skel = NULL;
 	struct ring_buffer *rb = NULL;
 	struct perf_buffer *pb = NULL;
+	struct replayer *replayer = NULL;
+	struct bpf_link *offcpu_link = NULL;
+	struct filters *filters = NULL;
 	int *lbr_perf_fds = NULL;
 	char vmlinux_path[1024] = {};
 	const struct ksym *stext_sym = 0;
-	int err, i, j, n;
-	__u64 ts1, ts2;
+	int err, out_err, i, j, n, filter_extra_cnt;
+	__u64 ts1, ts2, folded_ts, prof_ts;
 
 	if (setvbuf(stdout, NULL, _IOLBF, BUFSIZ))
 		fprintf(stderr, "Failed to set output mode to line-buffered!\n");
@@ -1932,6 +3097,15 @@ int main(int argc, char **argv)
 	if (err)
 		return -1;
 
+	/* in JSON mode stdout carries only JSON Lines, status goes to stderr */
+	if (env.json) {
+		err = output__take_stdout();
+		if (err) {
+			fprintf(stderr, "Failed to set up stdout for JSON output: %d\n", err);
+			return 1;
+		}
+	}
+
 	if (env.show_version) {
 		printf("%s\n", argp_program_version);
 		if (env.verbose) {
@@ -1945,15 +3119,43 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
-	if (geteuid() != 0)
-		fprintf(stderr, "You are not running as root! Expect failures. Please use sudo or run as root.\n");
+	if (env.replay_path) {
+		const char *kallsyms;
+		size_t kallsyms_sz;
 
-	/* Load and cache /proc/kallsyms for IP <-> kfunc mapping */
-	env.ctx.ksyms = ksyms = ksyms__load();
-	if (!ksyms) {
-		fprintf(stderr, "Failed to load /proc/kallsyms\n");
-		err = -EINVAL;
-		goto cleanup_silent;
+		if (env.record_path) {
+			fprintf(stderr, "--record and --replay can't be used together.\n");
+			return 1;
+		}
+
+		replayer = replayer__open(env.replay_path);
+		if (!replayer) {
+			err = -EINVAL;
+			goto cleanup_silent;
+		}
+
+		/* use kernel symbols and clock offset of recorded host */
+		ktime_off = replayer__hdr(replayer)->ktime_off;
+		kallsyms = replayer__kallsyms(replayer, &kallsyms_sz);
+		env.ctx.ksyms = ksyms = ksyms__load_buf(kallsyms, kallsyms_sz);
+		if (!ksyms) {
+			fprintf(stderr, "Failed to load kallsyms snapshot from recording\n");
+			err = -EINVAL;
+			goto cleanup_silent;
+		}
+	} else {
+		if (geteuid() != 0)
+			fprintf(stderr, "You are not running as root! Expect failures. Please use sudo or run as root.\n");
+
+		/* Load and cache /proc/kallsyms for IP <-> kfunc mapping */
+		prof_ts = startup_prof__ts();
+		env.ctx.ksyms = ksyms = ksyms__load();
+		startup_prof__phase("ksyms_load", prof_ts);
+		if (!ksyms) {
+			fprintf(stderr, "Failed to load /proc/kallsyms\n");
+			err = -EINVAL;
+			goto cleanup_silent;
+		}
 	}
 
 	stext_sym = ksyms__get_symbol(ksyms, "_stext");
@@ -1981,8 +3183,17 @@ int main(int argc, char **argv)
 		if (env.symb_mode == SYMB_DEFAULT || (env.symb_mode & SYMB_INLINES))
 			symb_inlines = true;
 
+		if (replayer) {
+			err = check_replay_build_id(replayer, env.vmlinux_path ?: vmlinux_path);
+			if (err && env.vmlinux_path)
+				goto cleanup_silent;
+			err = 0;
+		}
+
+		prof_ts = startup_prof__ts();
 		env.ctx.a2l = addr2line__init(env.vmlinux_path ?: vmlinux_path, stext_sym->addr,
 					      env.verbose, symb_inlines);
+		startup_prof__phase("addr2line_init", prof_ts);
 		if (!env.ctx.a2l) {
 			fprintf(stderr, "Failed to start addr2line for vmlinux image at %s!\n",
 				env.vmlinux_path ?: vmlinux_path);
@@ -1991,7 +3202,37 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (process_cu_globs()) {
+	if (env.folded_path) {
+		env.ctx.folded = folded__new();
+		if (!env.ctx.folded) {
+			fprintf(stderr, "Failed to allocate folded stacks state\n");
+			err = -ENOMEM;
+			goto cleanup_silent;
+		}
+	}
+
+	if (env.trace_export_path) {
+		env.ctx.te = trace_export__new(env.trace_export_path);
+		if (!env.ctx.te) {
+			err = -EINVAL;
+			goto cleanup_silent;
+		}
+	}
+
+	err = output__init(env.output_thread);
+	if (err)
+		goto cleanup_silent;
+
+	if (env.replay_path) {
+		signal(SIGINT, sig_handler);
+		err = replay_events(&env.ctx, replayer);
+		goto cleanup_silent;
+	}
+
+	prof_ts = startup_prof__ts();
+	err = process_cu_globs();
+	startup_prof__phase("cu_queries", prof_ts);
+	if (err) {
 		fprintf(stderr, "Failed to process file paths.\n");
 		err = -EINVAL;
 		goto cleanup_silent;
@@ -2010,7 +3251,10 @@ int main(int argc, char **argv)
 	/* Set up libbpf errors and debug info callback */
 	libbpf_set_print(libbpf_print_fn);
 
-	if (detect_kernel_features()) {
+	prof_ts = startup_prof__ts();
+	err = detect_kernel_features();
+	startup_prof__phase("feature_detect", prof_ts);
+	if (err) {
 		fprintf(stderr, "Kernel feature detection failed.\n");
 		err = -1;
 		goto cleanup_silent;
@@ -2024,7 +3268,9 @@ int main(int argc, char **argv)
 	}
 
 	/* Open BPF skeleton */
+	prof_ts = startup_prof__ts();
 	env.ctx.skel = skel = retsnoop_bpf__open();
+	startup_prof__phase("skel_open", prof_ts);
 	if (!skel) {
 		fprintf(stderr, "Failed to open BPF skeleton.\n");
 		err = -EINVAL;
@@ -2033,18 +3279,30 @@ int main(int argc, char **argv)
 
 	bpf_map__set_max_entries(skel->maps.stacks, env.stacks_map_sz);
 
-	skel->rodata->tgid_allow_cnt = env.allow_pid_cnt;
-	skel->rodata->tgid_deny_cnt = env.deny_pid_cnt;
-	if (env.allow_pid_cnt + env.deny_pid_cnt > 0) {
+	/* leave room for filters added at runtime */
+	filter_extra_cnt = env.filter_ctl_path ? FILTERS_CTL_MAX_CNT : 0;
+	if (env.allow_pid_cnt + env.deny_pid_cnt + filter_extra_cnt > 0) {
 		bpf_map__set_max_entries(skel->maps.tgids_filter,
-					 env.allow_pid_cnt + env.deny_pid_cnt);
+					 env.allow_pid_cnt + env.deny_pid_cnt + filter_extra_cnt);
 	}
-
-	skel->rodata->comm_allow_cnt = env.allow_comm_cnt;
-	skel->rodata->comm_deny_cnt = env.deny_comm_cnt;
-	if (env.allow_comm_cnt + env.deny_comm_cnt > 0) {
+	if (env.allow_comm_cnt + env.deny_comm_cnt + filter_extra_cnt > 0) {
 		bpf_map__set_max_entries(skel->maps.comms_filter,
-					 env.allow_comm_cnt + env.deny_comm_cnt);
+					 env.allow_comm_cnt + env.deny_comm_cnt + filter_extra_cnt);
+	}
+
+	/* cgroup filtering needs to be enabled upfront, as it is not supported
+	 * by older kernels, so it's only enabled if requested explicitly with
+	 * --cgroup or --no-cgroup; --filter-ctl can change cgroup filters then
+	 */
+	if (env.allow_cgroup_cnt + env.deny_cgroup_cnt > 0 && !env.has_ancestor_cgroup_id) {
+		fprintf(stderr, "Cgroup filtering is not supported by running kernel.\n");
+		err = -EOPNOTSUPP;
+		goto cleanup_silent;
+	}
+	skel->rodata->use_cgroup_filter = env.allow_cgroup_cnt + env.deny_cgroup_cnt > 0;
+	if (skel->rodata->use_cgroup_filter) {
+		bpf_map__set_max_entries(skel->maps.cgroups_filter,
+					 env.allow_cgroup_cnt + env.deny_cgroup_cnt + filter_extra_cnt);
 	}
 
 	/* turn on extra bpf_printk()'s on BPF side */
@@ -2095,6 +3353,12 @@ int main(int argc, char **argv)
 	if (env.use_lbr && env.verbose)
 		printf("LBR capture enabled.\n");
 
+	/* sched_switch handler is only needed for off-CPU time tracking */
+	skel->rodata->use_offcpu = env.offcpu;
+	if (env.offcpu)
+		bpf_map__set_max_entries(skel->maps.offcpu_stacks, env.stacks_map_sz);
+	bpf_program__set_autoload(skel->progs.handle_sched_switch, env.offcpu);
+
 	if (env.emit_func_trace) {
 		skel->rodata->emit_func_trace = true;
 
@@ -2126,6 +3390,7 @@ int main(int argc, char **argv)
 		goto cleanup_silent;
 	}
 	att_opts.func_filter = func_filter;
+	att_opts.plan_cache = !env.no_plan_cache;
 	att = mass_attacher__new(skel, ksyms, &att_opts);
 	if (!att)
 		goto cleanup_silent;
@@ -2166,6 +3431,14 @@ int main(int argc, char **argv)
 		goto cleanup_silent;
 	}
 
+	env.ctx.funcs = calloc(n, sizeof(*env.ctx.funcs));
+	if (!env.ctx.funcs) {
+		err = -ENOMEM;
+		goto cleanup_silent;
+	}
+	env.ctx.func_cnt = n;
+
+	prof_ts = startup_prof__ts();
 	vmlinux_btf = mass_attacher__btf(att);
 	for (i = 0; i < n; i++) {
 		const struct mass_attacher_func_info *finfo;
@@ -2188,11 +3461,19 @@ int main(int argc, char **argv)
 			break;
 		}
 
-		strncpy(skel->bss->func_names[i], finfo->name, MAX_FUNC_NAME_LEN - 1);
-		skel->bss->func_names[i][MAX_FUNC_NAME_LEN - 1] = '\0';
-		skel->bss->func_ips[i] = finfo->addr;
 		skel->bss->func_flags[i] = flags;
+
+		env.ctx.funcs[i].name = finfo->name;
+		env.ctx.funcs[i].module = finfo->module;
+		env.ctx.funcs[i].addr = finfo->addr;
+		env.ctx.funcs[i].size = finfo->size;
+		env.ctx.funcs[i].flags = flags;
 	}
+	startup_prof__phase("func_setup", prof_ts);
+
+	/* function names are only needed for BPF-side logging */
+	if (env.bpf_logs)
+		bpf_map__set_max_entries(skel->maps.func_debug_infos, n);
 
 	for (i = 0; i < env.entry_glob_cnt; i++) {
 		const struct glob *glob = &env.entry_globs[i];
@@ -2220,66 +3501,116 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (env.ctx.a2l && env.symb_mode != SYMB_NONE && !env.record_path) {
+		ts1 = now_ns();
+		prof_ts = startup_prof__ts();
+		err = symbolize_funcs(&env.ctx);
+		startup_prof__phase("func_symbolize", prof_ts);
+		if (err)
+			fprintf(stderr, "Failed to symbolize traced functions, ignoring: %d\n", err);
+		else if (env.verbose)
+			printf("Symbolized %d functions in %ld ms.\n",
+			       env.ctx.func_cnt, (long)((now_ns() - ts1) / 1000000));
+		err = 0;
+	}
+
+	if (env.record_path) {
+		env.ctx.rec = recorder__new(env.record_path, ktime_off, env.ctx.func_cnt);
+		if (!env.ctx.rec) {
+			err = -EINVAL;
+			goto cleanup_silent;
+		}
+		for (i = 0; i < env.ctx.func_cnt; i++) {
+			const struct func_meta *f = &env.ctx.funcs[i];
+
+			err = recorder__add_func(env.ctx.rec, f->name, f->module,
+						 f->addr, f->size, f->flags);
+			if (err) {
+				fprintf(stderr, "Failed to record function table: %d\n", err);
+				goto cleanup_silent;
+			}
+		}
+	}
+
 	err = mass_attacher__load(att);
 	if (err)
 		goto cleanup;
 
-	for (i = 0; i < env.allow_pid_cnt; i++) {
-		int tgid = env.allow_pids[i];
-		bool verdict = true; /* allowed */
+	for (i = 0; env.bpf_logs && !env.dry_run && i < env.ctx.func_cnt; i++) {
+		struct func_debug_info info = {};
 
-		err = bpf_map_update_elem(bpf_map__fd(skel->maps.tgids_filter),
-					  &tgid, &verdict, BPF_ANY);
+		strncat(info.name, env.ctx.funcs[i].name, MAX_FUNC_NAME_LEN - 1);
+		info.ip = env.ctx.funcs[i].addr;
+
+		err = bpf_map_update_elem(bpf_map__fd(skel->maps.func_debug_infos),
+					  &i, &info, BPF_ANY);
 		if (err) {
 			err = -errno;
+			fprintf(stderr, "Failed to setup function info for BPF logging: %d\n", err);
+			goto cleanup;
+		}
+	}
+
+	filters = filters__new(bpf_map__fd(skel->maps.tgids_filter),
+			       bpf_map__fd(skel->maps.comms_filter),
+			       skel->rodata->use_cgroup_filter ? bpf_map__fd(skel->maps.cgroups_filter) : -1,
+			       &skel->bss->filters, env.verbose);
+	if (!filters) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+	for (i = 0; i < env.allow_pid_cnt; i++) {
+		err = filters__set_pid(filters, env.allow_pids[i], FILTER_ALLOW);
+		if (err) {
 			fprintf(stderr, "Failed to setup PID allowlist: %d\n", err);
 			goto cleanup;
 		}
 	}
 	/* denylist overrides allowlist, if overlaps */
 	for (i = 0; i < env.deny_pid_cnt; i++) {
-		int tgid = env.deny_pids[i];
-		bool verdict = false; /* denied */
-
-		err = bpf_map_update_elem(bpf_map__fd(skel->maps.tgids_filter),
-					  &tgid, &verdict, BPF_ANY);
+		err = filters__set_pid(filters, env.deny_pids[i], FILTER_DENY);
 		if (err) {
-			err = -errno;
 			fprintf(stderr, "Failed to setup PID denylist: %d\n", err);
 			goto cleanup;
 		}
 	}
 	for (i = 0; i < env.allow_comm_cnt; i++) {
-		const char *comm = env.allow_comms[i];
-		char buf[TASK_COMM_LEN] = {};
-		bool verdict = true; /* allowed */
-
-		strncat(buf, comm, TASK_COMM_LEN - 1);
-
-		err = bpf_map_update_elem(bpf_map__fd(skel->maps.comms_filter),
-					  &buf, &verdict, BPF_ANY);
+		err = filters__set_comm(filters, env.allow_comms[i], FILTER_ALLOW);
 		if (err) {
-			err = -errno;
 			fprintf(stderr, "Failed to setup COMM allowlist: %d\n", err);
 			goto cleanup;
 		}
 	}
 	/* denylist overrides allowlist, if overlaps */
 	for (i = 0; i < env.deny_comm_cnt; i++) {
-		const char *comm = env.deny_comms[i];
-		char buf[TASK_COMM_LEN] = {};
-		bool verdict = false; /* denied */
-
-		strncat(buf, comm, TASK_COMM_LEN - 1);
-
-		err = bpf_map_update_elem(bpf_map__fd(skel->maps.comms_filter),
-					  &buf, &verdict, BPF_ANY);
+		err = filters__set_comm(filters, env.deny_comms[i], FILTER_DENY);
 		if (err) {
-			err = -errno;
 			fprintf(stderr, "Failed to setup COMM denylist: %d\n", err);
 			goto cleanup;
 		}
 	}
+	for (i = 0; i < env.allow_cgroup_cnt; i++) {
+		err = filters__set_cgroup(filters, env.allow_cgroups[i], FILTER_ALLOW);
+		if (err) {
+			fprintf(stderr, "Failed to setup cgroup allowlist for '%s': %d\n",
+				env.allow_cgroups[i], err);
+			goto cleanup;
+		}
+	}
+	/* denylist overrides allowlist, if overlaps */
+	for (i = 0; i < env.deny_cgroup_cnt; i++) {
+		err = filters__set_cgroup(filters, env.deny_cgroups[i], FILTER_DENY);
+		if (err) {
+			fprintf(stderr, "Failed to setup cgroup denylist for '%s': %d\n",
+				env.deny_cgroups[i], err);
+			goto cleanup;
+		}
+	}
+	if (env.filter_ctl_path) {
+		err = filters__open_ctl(filters, env.filter_ctl_path);
+		if (err)
+			goto cleanup;
+	}
 
 	ts1 = now_ns();
 
@@ -2292,6 +3623,15 @@ int main(int argc, char **argv)
     //自己的kretprobe在retsnoop之前挂载，可以保证在其之后执行清除当前pid->flow绑定关系的操作
     bpf_program__attach_kprobe(skel->progs.__tcp_transmit_skb_exit, 1, "__tcp_transmit_skb");
 
+	if (env.offcpu) {
+		offcpu_link = bpf_program__attach(skel->progs.handle_sched_switch);
+		if (!offcpu_link) {
+			err = -errno;
+			fprintf(stderr, "Failed to attach sched_switch handler for off-CPU tracking: %d\n", err);
+			goto cleanup;
+		}
+	}
+
 	ts2 = now_ns();
 	if (env.verbose)
 		printf("Successfully attached in %ld ms.\n", (long)((ts2 - ts1) / 1000000));
@@ -2305,7 +3645,9 @@ int main(int argc, char **argv)
 	signal(SIGINT, sig_handler);
 
 	env.ctx.att = att;
+	prof_ts = startup_prof__ts();
 	env.ctx.ksyms = ksyms__load();
+	startup_prof__phase("ksyms_load", prof_ts);
 	if (!env.ctx.ksyms) {
 		fprintf(stderr, "Failed to load /proc/kallsyms for symbolization.\n");
 		goto cleanup;
@@ -2331,12 +3673,19 @@ int main(int argc, char **argv)
 	}
 
 	/* Allow mass tracing */
+	prof_ts = startup_prof__ts();
 	mass_attacher__activate(att);
+	startup_prof__phase("activate", prof_ts);
+	startup_prof__report();
 
 	/* Process events */
 	if (env.bpf_logs)
 		printf("BPF-side logging is enabled. Use `sudo cat /sys/kernel/debug/tracing/trace_pipe` to see logs.\n");
-	printf("Receiving data...\n");
+	if (env.record_path)
+		printf("Recording data into '%s'...\n", env.record_path);
+	else
+		printf("Receiving data...\n");
+	ts1 = folded_ts = now_ns();
 	while (!exiting) {
 		err = rb ? ring_buffer__poll(rb, 100) : perf_buffer__poll(pb, 100);
 		/* Ctrl-C will cause -EINTR */
@@ -2348,20 +3697,75 @@ int main(int argc, char **argv)
 			printf("Error polling perf buffer: %d\n", err);
 			goto cleanup;
 		}
+
+		ts2 = now_ns();
+		if (ts2 - ts1 >= FT_STATS_PERIOD_NS) {
+			report_func_trace_stats();
+			ts1 = ts2;
+		}
+		if (env.ctx.folded && env.folded_period_s &&
+		    ts2 - folded_ts >= env.folded_period_s * 1000000000ULL) {
+			out_err = folded__write(env.ctx.folded, env.folded_path);
+			if (out_err)
+				fprintf(stderr, "Failed to write folded stacks into '%s': %d\n",
+					env.folded_path, out_err);
+			folded_ts = ts2;
+		}
+
+		/* write out stacks emitted during this poll iteration */
+		output__flush(false);
+
+		err = filters__poll_ctl(filters);
+		if (err)
+			goto cleanup;
 	}
 
 cleanup:
+	output__flush(true);
 	printf("\nDetaching... ");
 cleanup_silent:
+	/* no-op, unless startup was cut short (e.g., dry run or error) */
+	startup_prof__report();
+
+	out_err = output__fini();
+	if (out_err) {
+		fprintf(stderr, "Failed to write output: %d\n", out_err);
+		if (!err)
+			err = out_err;
+	}
 	fflush(stdout);
 
 	ts1 = now_ns();
 
+	filters__free(filters);
+	bpf_link__destroy(offcpu_link);
 	mass_attacher__free(att);
 
 	addr2line__free(env.ctx.a2l);
 	ksyms__free(env.ctx.ksyms);
 
+	if (env.ctx.rec) {
+		if (env.verbose)
+			printf("Recorded %zu events (%zu bytes). ",
+			       recorder__record_cnt(env.ctx.rec),
+			       recorder__byte_cnt(env.ctx.rec));
+		recorder__free(env.ctx.rec);
+	}
+	replayer__free(replayer);
+
+	if (env.ctx.folded) {
+		out_err = folded__write(env.ctx.folded, env.folded_path);
+		if (out_err)
+			fprintf(stderr, "Failed to write folded stacks into '%s': %d\n",
+				env.folded_path, out_err);
+		folded__free(env.ctx.folded);
+	}
+
+	out_err = trace_export__free(env.ctx.te);
+	if (out_err)
+		fprintf(stderr, "Failed to write trace export file '%s': %d\n",
+			env.trace_export_path, out_err);
+
 	for (i = 0; i < env.cpu_cnt; i++) {
 		if (lbr_perf_fds && lbr_perf_fds[i] >= 0)
 			close(lbr_perf_fds[i]);
@@ -2390,14 +3794,27 @@ cleanup_silent:
 	for (i = 0; i < env.deny_comm_cnt; i++)
 		free(env.deny_comms[i]);
 	free(env.deny_comms);
+	for (i = 0; i < env.allow_cgroup_cnt; i++)
+		free(env.allow_cgroups[i]);
+	free(env.allow_cgroups);
+	for (i = 0; i < env.deny_cgroup_cnt; i++)
+		free(env.deny_cgroups[i]);
+	free(env.deny_cgroups);
 
 	free(env.allow_pids);
 	free(env.deny_pids);
 
 	free_func_traces();
+	free_offcpu_stacks();
+
+	for (i = 0; i < env.ctx.func_cnt; i++)
+		free(env.ctx.funcs[i].src);
+	free(env.ctx.funcs);
 
 	free(stack_items1.items);
+	free(stack_items1.strs);
 	free(stack_items2.items);
+	free(stack_items2.strs);
 
 	if (err == 0) {
 		ts2 = now_ns();
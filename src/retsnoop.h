@@ -6,8 +6,10 @@
 #define MAX_CPUS 256
 #define MAX_CPUS_MSK (MAX_CPUS - 1)
 
-/* MAX_FUNC_CNT needs to be power-of-2 */
-#define MAX_FUNC_CNT (4 * 1024)
+/* MAX_FUNC_CNT needs to be power-of-2; func IDs are stored as unsigned
+ * short, so it can't go beyond 64K
+ */
+#define MAX_FUNC_CNT (64 * 1024)
 #define MAX_FUNC_MASK (MAX_FUNC_CNT - 1)
 #define MAX_FUNC_NAME_LEN 40
 
@@ -26,6 +28,7 @@ enum rec_type {
 	REC_FUNC_TRACE_START,
 	REC_FUNC_TRACE_ENTRY,
 	REC_FUNC_TRACE_EXIT,
+	REC_OFFCPU_STACK,
 };
 
 struct call_stack {
@@ -35,16 +38,23 @@ struct call_stack {
 	unsigned short func_ids[MAX_FSTACK_DEPTH];
 	long func_res[MAX_FSTACK_DEPTH];
 	long func_lat[MAX_FSTACK_DEPTH];
+	/* exclusive (self) latency of completed frames; for active frames,
+	 * accumulated inclusive latency of their completed children
+	 */
+	long func_self[MAX_FSTACK_DEPTH];
 	unsigned depth;
 	unsigned max_depth;
 	int pid, tgid;
 	long start_ts, emit_ts;
 	char task_comm[16], proc_comm[16];
 	bool is_err;
+	/* generation of filters task was last checked against */
+	__u64 filter_gen;
 
 	unsigned short saved_ids[MAX_FSTACK_DEPTH];
 	long saved_res[MAX_FSTACK_DEPTH];
 	long saved_lat[MAX_FSTACK_DEPTH];
+	long saved_self[MAX_FSTACK_DEPTH];
 	unsigned saved_depth;
 	unsigned saved_max_depth;
 
@@ -57,6 +67,24 @@ struct call_stack {
 	int next_seq_id;
 };
 
+/* Off-CPU times of call stack frames, kept separately from struct call_stack
+ * and only collected with --offcpu. Emitted right before corresponding call
+ * stack record.
+ */
+struct offcpu_stack {
+	/* REC_OFFCPU_STACK */
+	enum rec_type type;
+	int pid;
+
+	/* off-CPU time spent while frame was active (inclusive of children
+	 * once they complete), indexed the same way as call_stack's func_lat
+	 */
+	long func_offcpu[MAX_FSTACK_DEPTH];
+	long saved_offcpu[MAX_FSTACK_DEPTH];
+	/* timestamp of task being switched out, 0 if it is on CPU */
+	long offcpu_ts;
+};
+
 struct func_trace_start {
 	/* REC_FUNC_TRACE_START */
 	enum rec_type type;
@@ -83,11 +111,47 @@ struct func_trace_entry {
 
 	long func_lat;
 	long func_res;
+	long func_self_lat;
+	long func_offcpu_lat;
     //------新变量------
     struct flow_tuple flow_info;
     //------新变量------
 };
 
+/* function info only used for BPF-side logging (-l) */
+struct func_debug_info {
+	char name[MAX_FUNC_NAME_LEN];
+	__u64 ip;
+};
+
+/* cgroups nested deeper than that can't be used in cgroup filters */
+#define MAX_CGROUP_LEVEL 32
+
+/* PID/COMM/cgroup filters state, lives in BPF .bss and can be updated by
+ * user-space while tracing (--filter-ctl); filter sets themselves are in
+ * hash maps
+ */
+struct filter_state {
+	__u32 tgid_allow_cnt;
+	__u32 tgid_deny_cnt;
+	__u32 comm_allow_cnt;
+	__u32 comm_deny_cnt;
+	__u32 cgroup_allow_cnt;
+	__u32 cgroup_deny_cnt;
+	/* set once first allow filter of a kind is added and never reset,
+	 * so that denying or removing last allowed entry doesn't widen
+	 * tracing to everything
+	 */
+	bool tgid_allowlist;
+	bool comm_allowlist;
+	bool cgroup_allowlist;
+	/* bit mask of hierarchy levels of cgroups in cgroup filters */
+	__u32 cgroup_levels;
+	/* bumped after every change of filters */
+	__u64 gen;
+};
+
+/* per-function flags, have to fit in a byte */
 #define FUNC_IS_ENTRY 0x1
 #define FUNC_CANT_FAIL 0x2
 #define FUNC_NEEDS_SIGN_EXT 0x4
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "startup_prof.h"
+#include "utils.h"
+
+#define MAX_PHASE_CNT 64
+
+struct phase {
+	/* phase names are expected to be string literals */
+	const char *name;
+	uint64_t total_ns;
+	int cnt;
+
+	/* per-item durations, for percentiles */
+	uint64_t *items;
+	int item_cnt;
+	int item_cap;
+};
+
+static struct startup_prof {
+	bool enabled;
+	enum startup_prof_fmt fmt;
+	uint64_t start_ts;
+
+	struct phase phases[MAX_PHASE_CNT];
+	int phase_cnt;
+} prof;
+
+void startup_prof__enable(enum startup_prof_fmt fmt)
+{
+	prof.enabled = true;
+	prof.fmt = fmt;
+	prof.start_ts = now_ns();
+}
+
+uint64_t startup_prof__ts(void)
+{
+	return prof.enabled ? now_ns() : 0;
+}
+
+static struct phase *find_phase(const char *name)
+{
+	struct phase *p;
+	int i;
+
+	for (i = 0; i < prof.phase_cnt; i++) {
+		if (strcmp(prof.phases[i].name, name) == 0)
+			return &prof.phases[i];
+	}
+
+	/* silently drop phases beyond the limit, profile is best-effort */
+	if (prof.phase_cnt == MAX_PHASE_CNT)
+		return NULL;
+
+	p = &prof.phases[prof.phase_cnt++];
+	p->name = name;
+	return p;
+}
+
+void startup_prof__phase(const char *name, uint64_t start_ts)
+{
+	struct phase *p;
+
+	if (!prof.enabled)
+		return;
+
+	p = find_phase(name);
+	if (!p)
+		return;
+
+	p->total_ns += now_ns() - start_ts;
+	p->cnt++;
+}
+
+void startup_prof__item(const char *name, uint64_t start_ts)
+{
+	uint64_t dur;
+	struct phase *p;
+
+	if (!prof.enabled)
+		return;
+
+	dur = now_ns() - start_ts;
+
+	p = find_phase(name);
+	if (!p)
+		return;
+
+	p->total_ns += dur;
+	p->cnt++;
+
+	if (p->item_cnt == p->item_cap) {
+		int new_cap = p->item_cap ? p->item_cap * 2 : 256;
+		uint64_t *tmp;
+
+		tmp = realloc(p->items, new_cap * sizeof(*tmp));
+		if (!tmp)
+			return;
+		p->items = tmp;
+		p->item_cap = new_cap;
+	}
+	p->items[p->item_cnt++] = dur;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : (x > y);
+}
+
+static uint64_t percentile(const struct phase *p, int pct)
+{
+	return p->items[(long)(p->item_cnt - 1) * pct / 100];
+}
+
+static void report_table(uint64_t total_ns)
+{
+	const struct phase *p;
+	int i;
+
+	fprintf(stderr, "Startup profile (total %.3f ms):\n", total_ns / 1000000.0);
+	fprintf(stderr, "%-24s %8s %12s %12s %12s\n",
+		"PHASE", "COUNT", "TOTAL (ms)", "P50 (us)", "P99 (us)");
+	for (i = 0; i < prof.phase_cnt; i++) {
+		p = &prof.phases[i];
+
+		fprintf(stderr, "%-24s %8d %12.3f", p->name, p->cnt, p->total_ns / 1000000.0);
+		if (p->item_cnt) {
+			fprintf(stderr, " %12.3f %12.3f",
+				percentile(p, 50) / 1000.0, percentile(p, 99) / 1000.0);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+static void report_json(uint64_t total_ns)
+{
+	const struct phase *p;
+	int i;
+
+	fprintf(stderr, "{\"total_ns\":%llu,\"phases\":[", (unsigned long long)total_ns);
+	for (i = 0; i < prof.phase_cnt; i++) {
+		p = &prof.phases[i];
+
+		fprintf(stderr, "%s{\"name\":\"%s\",\"count\":%d,\"total_ns\":%llu",
+			i ? "," : "", p->name, p->cnt, (unsigned long long)p->total_ns);
+		if (p->item_cnt) {
+			fprintf(stderr, ",\"p50_ns\":%llu,\"p99_ns\":%llu",
+				(unsigned long long)percentile(p, 50),
+				(unsigned long long)percentile(p, 99));
+		}
+		fprintf(stderr, "}");
+	}
+	fprintf(stderr, "]}\n");
+}
+
+void startup_prof__report(void)
+{
+	uint64_t total_ns;
+	int i;
+
+	if (!prof.enabled)
+		return;
+
+	total_ns = now_ns() - prof.start_ts;
+
+	for (i = 0; i < prof.phase_cnt; i++) {
+		struct phase *p = &prof.phases[i];
+
+		if (p->item_cnt)
+			qsort(p->items, p->item_cnt, sizeof(*p->items), cmp_u64);
+	}
+
+	if (prof.fmt == STARTUP_PROF_JSON)
+		report_json(total_ns);
+	else
+		report_table(total_ns);
+
+	for (i = 0; i < prof.phase_cnt; i++)
+		free(prof.phases[i].items);
+	memset(&prof, 0, sizeof(prof));
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __STARTUP_PROF_H
+#define __STARTUP_PROF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Startup phase profiler (--startup-profile).
+ *
+ * Each phase is identified by name and is reported in the order it was
+ * first recorded. Repeated recordings of the same phase are accumulated.
+ * Phases made of many similar steps (e.g., attaching each function) record
+ * each step as an item, for which per-item p50/p99 costs are reported as
+ * well.
+ *
+ * All functions are no-ops unless profiling is enabled. Not thread-safe,
+ * record from the main thread only.
+ */
+enum startup_prof_fmt {
+	STARTUP_PROF_TABLE,
+	STARTUP_PROF_JSON,
+};
+
+void startup_prof__enable(enum startup_prof_fmt fmt);
+
+/* returns timestamp to pass as start_ts to phase/item recording functions */
+uint64_t startup_prof__ts(void);
+
+/* account time since start_ts to a given phase */
+void startup_prof__phase(const char *name, uint64_t start_ts);
+/* account time since start_ts as a single item of a given phase */
+void startup_prof__item(const char *name, uint64_t start_ts);
+
+/* emit report to stderr and free all the collected data */
+void startup_prof__report(void);
+
+#endif /* __STARTUP_PROF_H */
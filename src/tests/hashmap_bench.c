@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+/*
+ * Micro-benchmark comparing chained hashmap and open-addressing int_hashmap
+ * under pid-keyed churn, similar to what function trace ingestion does:
+ * a working set of live pids with constant lookups, while pids come and go.
+ *
+ * Usage: hashmap_bench [LIVE_PIDS [OPS]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "hashmap.h"
+
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static size_t pid_hasher(const void *key, void *ctx)
+{
+	return (size_t)key;
+}
+
+static bool pid_equal(const void *key1, const void *key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+/* deterministic pid-like sequence, so both maps see the same workload */
+static unsigned long rnd_state;
+
+static int next_pid(void)
+{
+	rnd_state = rnd_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return 1 + (rnd_state >> 33) % 4194304; /* default pid_max */
+}
+
+static int *gen_pids(int cnt)
+{
+	int *pids = malloc(cnt * sizeof(*pids));
+	int i;
+
+	if (!pids)
+		return NULL;
+	for (i = 0; i < cnt; i++)
+		pids[i] = next_pid();
+	return pids;
+}
+
+/* each op: a few lookups of live pids, then replace one live pid with a new one */
+#define FINDS_PER_OP 8
+
+static long bench_hashmap(int *live, int live_cnt, const int *fresh, int op_cnt)
+{
+	struct hashmap *map = hashmap__new(pid_hasher, pid_equal, NULL);
+	long found = 0;
+	void *v;
+	int i, j, idx = 0, victim = -1;
+
+	for (i = 0; i < live_cnt; i++)
+		hashmap__add(map, (const void *)(uintptr_t)live[i], (void *)(uintptr_t)1);
+
+	for (i = 0; i < op_cnt; i++) {
+		for (j = 0; j < FINDS_PER_OP; j++) {
+			found += hashmap__find(map, (const void *)(uintptr_t)live[idx], &v);
+			if (++idx == live_cnt)
+				idx = 0;
+		}
+		if (++victim == live_cnt)
+			victim = 0;
+		hashmap__delete(map, (const void *)(uintptr_t)live[victim], NULL, NULL);
+		live[victim] = fresh[i];
+		hashmap__add(map, (const void *)(uintptr_t)live[victim], (void *)(uintptr_t)1);
+	}
+
+	hashmap__free(map);
+	return found;
+}
+
+static long bench_int_hashmap(int *live, int live_cnt, const int *fresh, int op_cnt)
+{
+	struct int_hashmap *map = int_hashmap__new();
+	long found = 0;
+	void *v;
+	int i, j, idx = 0, victim = -1;
+
+	for (i = 0; i < live_cnt; i++)
+		int_hashmap__add(map, live[i], (void *)(uintptr_t)1);
+
+	for (i = 0; i < op_cnt; i++) {
+		for (j = 0; j < FINDS_PER_OP; j++) {
+			found += int_hashmap__find(map, live[idx], &v);
+			if (++idx == live_cnt)
+				idx = 0;
+		}
+		if (++victim == live_cnt)
+			victim = 0;
+		int_hashmap__delete(map, live[victim], NULL);
+		live[victim] = fresh[i];
+		int_hashmap__add(map, live[victim], (void *)(uintptr_t)1);
+	}
+
+	int_hashmap__free(map);
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	int live_cnt = argc > 1 ? atoi(argv[1]) : 4096;
+	int op_cnt = argc > 2 ? atoi(argv[2]) : 4000000;
+	long found1, found2;
+	uint64_t ts1, ts2, ts3;
+	int *live, *live2, *fresh;
+
+	if (live_cnt <= 0 || op_cnt <= 0) {
+		fprintf(stderr, "Usage: %s [LIVE_PIDS [OPS]]\n", argv[0]);
+		return 1;
+	}
+
+	rnd_state = 42;
+	live = gen_pids(live_cnt);
+	fresh = gen_pids(op_cnt);
+	live2 = malloc(live_cnt * sizeof(*live2));
+	if (!live || !fresh || !live2) {
+		fprintf(stderr, "Failed to allocate pids\n");
+		return 1;
+	}
+
+	memcpy(live2, live, live_cnt * sizeof(*live));
+
+	ts1 = now_ns();
+	found1 = bench_hashmap(live, live_cnt, fresh, op_cnt);
+	ts2 = now_ns();
+	found2 = bench_int_hashmap(live2, live_cnt, fresh, op_cnt);
+	ts3 = now_ns();
+
+	printf("%d live pids, %d ops (%d finds + delete + add each):\n",
+	       live_cnt, op_cnt, FINDS_PER_OP);
+	printf("  hashmap:     %8.2f ns/op (%ld found)\n",
+	       (double)(ts2 - ts1) / op_cnt, found1);
+	printf("  int_hashmap: %8.2f ns/op (%ld found)\n",
+	       (double)(ts3 - ts2) / op_cnt, found2);
+
+	free(live);
+	free(live2);
+	free(fresh);
+
+	if (found1 != found2) {
+		fprintf(stderr, "Maps disagree on lookup results!\n");
+		return 1;
+	}
+	return 0;
+}
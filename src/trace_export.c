@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-2-Clause
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <linux/perf_event.h>
+#include "retsnoop.h"
+#include "trace_export.h"
+#include "hashmap.h"
+#include "utils.h"
+
+#define TRACE_EXPORT_BUF_SZ (1024 * 1024)
+
+struct trace_export {
+	FILE *f;
+	char *buf;
+	long event_cnt;
+	/* threads for which name metadata events were already emitted */
+	struct hashmap *threads;
+};
+
+static size_t pid_hasher(const void *key, void *ctx)
+{
+	return (size_t)key;
+}
+
+static bool pid_equal(const void *key1, const void *key2, void *ctx)
+{
+	return key1 == key2;
+}
+
+struct trace_export *trace_export__new(const char *path)
+{
+	struct trace_export *te;
+	int err;
+
+	te = calloc(1, sizeof(*te));
+	if (!te)
+		return NULL;
+
+	te->buf = malloc(TRACE_EXPORT_BUF_SZ);
+	te->threads = hashmap__new(pid_hasher, pid_equal, NULL);
+	if (!te->buf || !te->threads)
+		goto err_out;
+
+	te->f = fopen(path, "w");
+	if (!te->f) {
+		err = -errno;
+		fprintf(stderr, "Failed to create trace export file '%s': %d\n", path, err);
+		goto err_out;
+	}
+	setvbuf(te->f, te->buf, _IOFBF, TRACE_EXPORT_BUF_SZ);
+
+	fprintf(te->f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	return te;
+
+err_out:
+	trace_export__free(te);
+	return NULL;
+}
+
+int trace_export__free(struct trace_export *te)
+{
+	int err = 0;
+
+	if (!te)
+		return 0;
+
+	if (te->f) {
+		fprintf(te->f, "\n]}\n");
+		if (ferror(te->f))
+			err = -EIO;
+		if (fclose(te->f))
+			err = -errno;
+	}
+	hashmap__free(te->threads);
+	free(te->buf);
+	free(te);
+
+	return err;
+}
+
+static void json_emit(void *ctx, const char *s, size_t len)
+{
+	fwrite(s, 1, len, ctx);
+}
+
+static void emit_str(FILE *f, const char *str)
+{
+	json_emit_str(str, json_emit, f);
+}
+
+/* trace-event timestamps are in microseconds, keep ns precision */
+static void emit_us(FILE *f, const char *key, long ns)
+{
+	fprintf(f, ",\"%s\":%ld.%03ld", key, ns / 1000, ns % 1000);
+}
+
+static void emit_flow(FILE *f, const char *key, const struct flow_tuple *flow)
+{
+	fprintf(f, ",\"%s\":{\"saddr\":%u,\"sport\":%u,\"daddr\":%u,\"dport\":%u}",
+		key, flow->saddr, flow->sport, flow->daddr, flow->dport);
+}
+
+static void start_event(struct trace_export *te)
+{
+	if (te->event_cnt++)
+		fprintf(te->f, ",\n");
+}
+
+int trace_export__add_thread(struct trace_export *te, int pid, int tgid,
+			     const char *comm, const char *proc_comm)
+{
+	int err;
+
+	if (hashmap__find(te->threads, (const void *)(uintptr_t)pid, NULL))
+		return 0;
+
+	err = hashmap__add(te->threads, (const void *)(uintptr_t)pid, NULL);
+	if (err)
+		return err;
+
+	if (pid == tgid) {
+		start_event(te);
+		fprintf(te->f, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+			tgid, pid);
+		emit_str(te->f, proc_comm);
+		fprintf(te->f, "}}");
+	}
+
+	start_event(te);
+	fprintf(te->f, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+		tgid, pid);
+	emit_str(te->f, comm);
+	fprintf(te->f, "}}");
+
+	return ferror(te->f) ? -EIO : 0;
+}
+
+int trace_export__add_call(struct trace_export *te, int pid, int tgid,
+			   const struct trace_export_call *call)
+{
+	FILE *f = te->f;
+
+	start_event(te);
+	fprintf(f, "{\"ph\":\"X\",\"cat\":\"func\",\"name\":");
+	emit_str(f, call->name);
+	fprintf(f, ",\"pid\":%d,\"tid\":%d", tgid, pid);
+	emit_us(f, "ts", call->ts);
+	emit_us(f, "dur", call->dur);
+
+	fprintf(f, ",\"args\":{\"depth\":%d", call->depth);
+	if (call->has_res)
+		fprintf(f, ",\"res\":%ld", call->res);
+	if (call->entry_flow)
+		emit_flow(f, "entry_flow", call->entry_flow);
+	if (call->exit_flow)
+		emit_flow(f, "exit_flow", call->exit_flow);
+	fprintf(f, "}}");
+
+	return ferror(f) ? -EIO : 0;
+}
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef __TRACE_EXPORT_H
+#define __TRACE_EXPORT_H
+
+#include <stdbool.h>
+
+struct flow_tuple;
+
+/*
+ * Export of function call traces in Chrome trace-event JSON format, which
+ * can be loaded into chrome://tracing or Perfetto UI.
+ *
+ * Each completed function call becomes a complete ("X") event on a
+ * process (tgid) / thread (pid) track, with function result, call depth,
+ * and flow tuples as event args. Timestamps are BPF (monotonic) time.
+ */
+struct trace_export;
+
+struct trace_export *trace_export__new(const char *path);
+/* finalizes JSON document, so has to be called for the file to be valid */
+int trace_export__free(struct trace_export *te);
+
+int trace_export__add_thread(struct trace_export *te, int pid, int tgid,
+			     const char *comm, const char *proc_comm);
+
+struct trace_export_call {
+	const char *name;
+	long ts;	/* entry timestamp, ns */
+	long dur;	/* ns */
+	int depth;
+	long res;
+	bool has_res;
+	const struct flow_tuple *entry_flow;
+	const struct flow_tuple *exit_flow;
+};
+
+int trace_export__add_call(struct trace_export *te, int pid, int tgid,
+			   const struct trace_export_call *call);
+
+#endif /* __TRACE_EXPORT_H */
@@ -5,6 +5,11 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libelf.h>
+#include <gelf.h>
 #include "utils.h"
 
 static const char *err_map[] = {
@@ -94,34 +99,225 @@ void ts_to_str(uint64_t ts, char buf[], size_t buf_sz)
 	snprintf(buf, buf_sz, "%s.%06lu", tmp, ts / 1000 % 1000000);
 }
 
-/* adapted from libbpf sources */
-bool glob_matches(const char *glob, const char *s)
+/*
+ * Kernel build ID helpers
+ */
+
+#define NOTE_ALIGN(sz) (((sz) + 3) & ~3UL)
+
+/* Find GNU build ID note among ELF notes in buf, copy it into build_id and
+ * return its size, or return negative error, if it's not there.
+ */
+static int find_build_id_note(const char *buf, size_t len, unsigned char *build_id, size_t max_sz)
 {
-	while (*s && *glob && *glob != '*') {
-		/* Matches any single character */
-		if (*glob == '?') {
-			s++;
-			glob++;
+	size_t off = 0, desc_off;
+	Elf64_Nhdr nhdr;
+
+	while (off + sizeof(nhdr) <= len) {
+		memcpy(&nhdr, buf + off, sizeof(nhdr));
+		off += sizeof(nhdr);
+
+		desc_off = off + NOTE_ALIGN(nhdr.n_namesz);
+		if (desc_off + nhdr.n_descsz > len)
+			break;
+
+		if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == sizeof("GNU") &&
+		    memcmp(buf + off, "GNU", sizeof("GNU")) == 0) {
+			if (nhdr.n_descsz > max_sz)
+				return -E2BIG;
+			memcpy(build_id, buf + desc_off, nhdr.n_descsz);
+			return nhdr.n_descsz;
+		}
+
+		off = desc_off + NOTE_ALIGN(nhdr.n_descsz);
+	}
+
+	return -ENOENT;
+}
+
+/* Build ID of running kernel, from /sys/kernel/notes */
+int kernel_build_id(unsigned char *build_id, size_t max_sz)
+{
+	char buf[4096];
+	size_t len;
+	FILE *f;
+
+	f = fopen("/sys/kernel/notes", "r");
+	if (!f)
+		return -errno;
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	return find_build_id_note(buf, len, build_id, max_sz);
+}
+
+/* Build ID of vmlinux (or any other ELF) image, from its note sections */
+int elf_build_id(const char *path, unsigned char *build_id, size_t max_sz)
+{
+	Elf_Scn *scn = NULL;
+	Elf_Data *data;
+	GElf_Shdr shdr;
+	Elf *elf;
+	int fd, err = -ENOENT;
+
+	if (elf_version(EV_CURRENT) == EV_NONE)
+		return -EINVAL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	if (!elf) {
+		err = -EINVAL;
+		goto cleanup;
+	}
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_NOTE)
 			continue;
+
+		data = elf_getdata(scn, NULL);
+		if (!data)
+			continue;
+
+		err = find_build_id_note(data->d_buf, data->d_size, build_id, max_sz);
+		if (err != -ENOENT)
+			break;
+	}
+
+cleanup:
+	if (elf)
+		elf_end(elf);
+	close(fd);
+	return err;
+}
+
+/*
+ * JSON helpers
+ */
+
+/* Emit str as quoted and escaped JSON string, piece by piece, through emit */
+void json_emit_str(const char *str, json_emit_fn emit, void *ctx)
+{
+	char esc[8];
+	const char *p;
+
+	emit(ctx, "\"", 1);
+	for (p = str; *p; p++) {
+		/* copy runs of characters not needing escaping as is */
+		if (*p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+			continue;
+		if (p > str)
+			emit(ctx, str, p - str);
+		switch (*p) {
+		case '"':
+		case '\\':
+			esc[0] = '\\';
+			esc[1] = *p;
+			emit(ctx, esc, 2);
+			break;
+		case '\n':
+			emit(ctx, "\\n", 2);
+			break;
+		case '\t':
+			emit(ctx, "\\t", 2);
+			break;
+		default:
+			emit(ctx, esc, snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*p));
+			break;
 		}
-		if (*s != *glob)
-			return false;
-		s++;
-		glob++;
+		str = p + 1;
 	}
-	/* Check wild card */
-	if (*glob == '*') {
-		while (*glob == '*') {
-			glob++;
+	if (p > str)
+		emit(ctx, str, p - str);
+	emit(ctx, "\"", 1);
+}
+
+/*
+ * File helpers
+ */
+
+/* Read whole file into a NUL-terminated malloc()'ed buffer with large read()
+ * calls. Works for procfs/tracefs files, which report zero size and can't be
+ * mmap()'ed, as well.
+ */
+int read_file(const char *path, char **buf, size_t *sz)
+{
+	size_t cap = 0, len = 0;
+	char *data = NULL, *tmp;
+	ssize_t n;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while (true) {
+		if (cap - len < 2) {
+			cap = cap ? cap * 2 : 1024 * 1024;
+			tmp = realloc(data, cap);
+			if (!tmp) {
+				err = -ENOMEM;
+				goto err_out;
+			}
+			data = tmp;
 		}
-		if (!*glob) /* Tail wild card matches all */
-			return true;
-		while (*s) {
-			if (glob_matches(glob, s++))
+		n = read(fd, data + len, cap - len - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			err = -errno;
+			goto err_out;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	close(fd);
+
+	data[len] = '\0';
+	*buf = data;
+	*sz = len;
+	return 0;
+
+err_out:
+	free(data);
+	close(fd);
+	return err;
+}
+
+/* Non-recursive glob matching supporting '*' and '?' wildcards. On mismatch
+ * only the most recent '*' is retried with one more character consumed, as
+ * earlier stars can't produce a match that the latest one can't, so matching
+ * takes at most O(len(glob) * len(s)) steps, instead of exponential time of
+ * naive backtracking.
+ */
+bool glob_matches(const char *glob, const char *s)
+{
+	const char *star = NULL, *star_s = NULL;
+
+	while (*s) {
+		if (*glob == '*') {
+			while (*glob == '*')
+				glob++;
+			if (!*glob) /* Tail wild card matches all */
 				return true;
+			star = glob;
+			star_s = s;
+		} else if (*glob == '?' || *glob == *s) {
+			glob++;
+			s++;
+		} else if (star) {
+			glob = star;
+			s = ++star_s;
+		} else {
+			return false;
 		}
 	}
-	return !*s && !*glob;
+	while (*glob == '*')
+		glob++;
+	return !*glob;
 }
 
 bool full_glob_matches(const char *name_glob, const char *mod_glob,
@@ -237,15 +433,18 @@ cleanup:
 	return err;
 }
 
-int append_compile_unit(struct addr2line *a2l, struct glob **globs, int *cnt,
-			const char *cu, bool mandatory)
+int append_compile_units(struct addr2line *a2l, struct glob **globs, int *cnt,
+			 char **cus, int cu_cnt, bool mandatory)
 {
 	int err = 0;
 	struct a2l_cu_resp *cu_resps = NULL;
 	int resp_cnt;
 	int i;
 
-	resp_cnt = addr2line__query_symbols(a2l, cu, &cu_resps);
+	if (cu_cnt == 0)
+		return 0;
+
+	resp_cnt = addr2line__query_symbols(a2l, (const char **)cus, cu_cnt, &cu_resps);
 	if (resp_cnt < 0) {
 		return resp_cnt;
 	}
@@ -42,6 +42,27 @@ static inline uint64_t now_ns(void)
 
 void ts_to_str(uint64_t ts, char buf[], size_t buf_sz);
 
+/*
+ * Kernel build ID helpers
+ */
+
+int kernel_build_id(unsigned char *build_id, size_t max_sz);
+int elf_build_id(const char *path, unsigned char *build_id, size_t max_sz);
+
+/*
+ * JSON helpers
+ */
+
+typedef void (*json_emit_fn)(void *ctx, const char *s, size_t len);
+
+void json_emit_str(const char *str, json_emit_fn emit, void *ctx);
+
+/*
+ * File helpers
+ */
+
+int read_file(const char *path, char **buf, size_t *sz);
+
 /*
  * Glob helpers
  */
@@ -62,7 +83,8 @@ int append_str_file(char ***strs, int *cnt, const char *file);
 int append_glob(struct glob **globs, int *cnt, const char *str, bool mandatory);
 int append_glob_file(struct glob **globs, int *cnt, const char *file, bool mandatory);
 
-int append_compile_unit(struct addr2line *a2l, struct glob **globs, int *cnt, const char *cu, bool mandatory);
+int append_compile_units(struct addr2line *a2l, struct glob **globs, int *cnt,
+			 char **cus, int cu_cnt, bool mandatory);
 
 int append_pid(int **pids, int *cnt, const char *arg);
 